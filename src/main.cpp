@@ -10,13 +10,20 @@ See license text in LICENSE file
 #include <dirent.h>
 #include <glob.h>
 #include <string.h>
+#include <unistd.h>
 //---------------------------------------------------------------------------
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
 //---------------------------------------------------------------------------
 #include "./parameters.h"
 #include "./util_fs.h"
 #include "./util_visualize.h"
+#include "./util_stats.h"
+#include "./util_reduce.h"
 //---------------------------------------------------------------------------
 #define BIN2GIF_VERSION "0.5"
 #define BIN2GIF_AUTHOR "Oleg Efimov"
@@ -45,28 +52,56 @@ void display_help(const char *argv0) {
 
     printf("Usage: %s [options] [--] <filename|dirname|pattern>\n", program_name); // NOLINT
     printf("Utility to convert binary 2D data file into GIF images.\n");
-    printf("Supports 'double' and 'complex<double>' C/C++ data types.\n");
+    printf("Supports 'double', 'complex<double>', 'float', 'complex<float>',\n");
+    printf("'int16_t' and 'int32_t' C/C++ data types.\n");
 
     printf("\nOptions:\n");
     printf("    -s, --size (<num>|<num>x<num>)       dimensions of data in binary file\n"); // NOLINT
     printf("    -r, --resize (<num>|<num>x<num>)     dimensions of produced image\n"); // NOLINT
-    printf("    -t, --type (double|d|complex|c)      type of binary data\n");
-    printf("    -f, --func (abs|norm|real|imag|arg)  function for complex to real conversion\n"); // NOLINT
+    printf("    --filter (area|bilinear|lanczos3|max|min)\n"); // NOLINT
+    printf("                                         resampling filter for any output size, area by default\n"); // NOLINT
+    printf("    -t, --type (double|d|complex|c|float|f|cfloat|int16|int32)\n"); // NOLINT
+    printf("                                         type of binary data, double and complex are detected\n"); // NOLINT
+    printf("    --byteswap                           binary data is big-endian\n"); // NOLINT
+    printf("    -f, --func (abs|norm|real|imag|arg)  function for complex to real conversion,\n"); // NOLINT
+    printf("                                         comma separated list for image of each from one read\n"); // NOLINT
     printf("    -a, --amp <double>                   value of image color scale amplitude\n"); // NOLINT
     printf("    -e                                   set amplitude to e^-1\n");
     printf("    --min <double>                       value of image color scale minimum\n"); // NOLINT
     printf("    --max <double>                       value of image color scale maximum\n"); // NOLINT
+    printf("    --range p<low>:p<high>               color scale range by data percentiles, e.g. p0.5:p99.5,\n"); // NOLINT
+    printf("                                         NaN and infinite values are skipped\n"); // NOLINT
+    printf("    --scale (linear|log|symlog)          color scale, log of range not above zero starts 6 decades below max\n"); // NOLINT
+    printf("    --linthresh <double>                 linear range around zero of symlog scale, 1e-3 of max magnitude by default\n"); // NOLINT
     printf("    --reflect                            reflect image, swaps x and y coords\n"); // NOLINT
-    printf("    --palette <filename>                 color palette filename\n");
+    printf("    --palette (<name>|<filename>)        color palette: gray, rainbow, blue-red, black-white, white-black,\n"); // NOLINT
+    printf("                                         viridis, magma, inferno, plasma, cividis, or palette file\n"); // NOLINT
     printf("    --axial                              color palette filename\n"); // NOLINT
+    printf("    --layer <num>                        draw time layer <num> of --axial file, central by default\n"); // NOLINT
+    printf("    --layers <first>:<last>[:<step>]     draw every <step> layer of --axial file into own image\n"); // NOLINT
     printf("    --mathgl                             use MathGL to draw image\n"); // NOLINT
-    printf("    --text                               export data as TSV text file\n\n"); // NOLINT
+    printf("    --text                               export data as TSV text file\n"); // NOLINT
+    printf("    --fast-math                          approximate arg, error below 2e-6 rad\n"); // NOLINT
+    printf("    --stream                             read input by row stripes, memory scales with image\n"); // NOLINT
+    printf("    --crop <x>,<y>,<width>,<height>      draw only this region of matrix, only it is read\n"); // NOLINT
+    printf("    --preview <num>                      draw every <num> row and column, only these rows are read\n"); // NOLINT
+    printf("    --pyramid                            write deep zoom image: .dzi and 256x256 tiles of every 2x level\n\n"); // NOLINT
+
+    printf("    -j, --jobs <num>                     convert <num> files in parallel, 0 for all cores\n"); // NOLINT
+    printf("    --max-memory <num>[K|M|G]            memory budget for files converted in parallel\n"); // NOLINT
+    printf("    --gif-tiles <num>                    LZW encode <num> row tiles of image in parallel, 0 for all cores\n\n"); // NOLINT
+
+    printf("    --animate <filename>                 write files in name order as frames of one animated GIF\n"); // NOLINT
+    printf("    --delay <num>                        animation frame delay in 1/100 s\n"); // NOLINT
+    printf("    --cache                              keep reduced data to render again without reading input\n"); // NOLINT
+    printf("    --global-range                       one color scale range for all files, kept in .bin2gif_index\n\n"); // NOLINT
 
     printf("    --header <num>                       size of file header in bytes\n"); // NOLINT
     printf("    --footer <num>                       size of file footer in bytes\n"); // NOLINT
     printf("    --delete-original                    delete original file after convert\n"); // NOLINT
     printf("    --debug                              do debug output\n");
-    printf("    --force                              force rewrite existing GIF files\n"); // NOLINT
+    printf("    --force                              rewrite GIF files even if they are up to date\n"); // NOLINT
+    printf("    --hash                               compare input contents too, not only size and mtime, before rebuild\n"); // NOLINT
     printf("    --verbose                            verbosely output\n\n");
     printf("    -v, --version                        display program vesion\n");
     printf("    -h, --help                           display this help page\n");
@@ -78,6 +113,31 @@ void display_help(const char *argv0) {
            program_name);
 }
 //---------------------------------------------------------------------------
+off_t parse_memory_size(const char *str) {
+    double size = 0;
+    char suffix = '\0';
+
+    if (sscanf(str, "%lf%c", &size, &suffix) < 1 || size < 0) {
+        return 0;
+    }
+
+    switch (suffix) {
+        case 'g':
+        case 'G':
+            size *= 1024;
+        case 'm':
+        case 'M':
+            size *= 1024;
+        case 'k':
+        case 'K':
+            size *= 1024;
+        default:
+            break;
+    }
+
+    return static_cast<off_t>(size);
+}
+//---------------------------------------------------------------------------
 void get_program_options(int argc, char *argv[],
                          sns::bin2gif_parameters *p_params) {
     int c = 0;
@@ -86,17 +146,39 @@ void get_program_options(int argc, char *argv[],
     static struct option loptions[] = {
         {"size", required_argument, NULL, 's'},
         {"resize", required_argument, NULL, 'r'},
+        {"filter", required_argument, NULL, 0},
         {"type", required_argument, NULL, 't'},
         {"func", required_argument, NULL, 'f'},
         {"amp", required_argument, NULL, 'a'},
         {"min", required_argument, NULL, 0},
         {"max", required_argument, NULL, 0},
+        {"range", required_argument, NULL, 0},
+        {"scale", required_argument, NULL, 0},
+        {"linthresh", required_argument, NULL, 0},
         {"reflect", no_argument, NULL, 0},
         {"palette", required_argument, NULL, 0},
         {"axial", no_argument, NULL, 0},
         {"axial-all", no_argument, NULL, 0},
+        {"layer", required_argument, NULL, 0},
+        {"layers", required_argument, NULL, 0},
         {"text", no_argument, NULL, 0},
         {"mathgl", no_argument, NULL, 0},
+        {"stream", no_argument, NULL, 0},
+        {"fast-math", no_argument, NULL, 0},
+        {"byteswap", no_argument, NULL, 0},
+        {"crop", required_argument, NULL, 0},
+        {"preview", required_argument, NULL, 0},
+        {"pyramid", no_argument, NULL, 0},
+
+        {"jobs", required_argument, NULL, 'j'},
+        {"max-memory", required_argument, NULL, 0},
+        {"gif-tiles", required_argument, NULL, 0},
+
+        {"animate", required_argument, NULL, 0},
+        {"delay", required_argument, NULL, 0},
+        {"global-range", no_argument, NULL, 0},
+        {"hash", no_argument, NULL, 0},
+        {"cache", no_argument, NULL, 0},
 
         {"header", required_argument, NULL, 0},
         {"footer", required_argument, NULL, 0},
@@ -111,7 +193,7 @@ void get_program_options(int argc, char *argv[],
     };
     int oindex = 0;
 
-    while ((c = getopt_long_only(argc, argv, "s:r:t:f:a:ehvd",
+    while ((c = getopt_long_only(argc, argv, "s:r:t:f:a:j:ehvd",
                                  loptions, &oindex)) != -1) {
         switch (c) {
             case 0:
@@ -125,6 +207,20 @@ void get_program_options(int argc, char *argv[],
                     p_params->export_text = true;
                 } else if (strcmp(loptions[oindex].name, "mathgl") == 0) {
                     p_params->use_mathgl = true;
+                } else if (strcmp(loptions[oindex].name, "stream") == 0) {
+                    p_params->stream = true;
+                } else if (strcmp(loptions[oindex].name, "fast-math") == 0) {
+                    p_params->fast_math = true;
+                } else if (strcmp(loptions[oindex].name, "byteswap") == 0) {
+                    p_params->byteswap = true;
+                } else if (strcmp(loptions[oindex].name, "pyramid") == 0) {
+                    p_params->pyramid = true;
+                } else if (strcmp(loptions[oindex].name, "global-range") == 0) { // NOLINT
+                    p_params->global_range = true;
+                } else if (strcmp(loptions[oindex].name, "hash") == 0) {
+                    p_params->hash_inputs = true;
+                } else if (strcmp(loptions[oindex].name, "cache") == 0) {
+                    p_params->use_cache = true;
                 } else if (strcmp(loptions[oindex].name, "palette") == 0) {
                     p_params->palette_file = optarg;
                 } else if (strcmp(loptions[oindex].name, "delete-original") == 0) { // NOLINT
@@ -145,6 +241,60 @@ void get_program_options(int argc, char *argv[],
                 } else if (strcmp(loptions[oindex].name, "max") == 0) {
                     sscanf(optarg, "%lf", &p_params->to_max);
                     p_params->to_use_max = true;
+                } else if (strcmp(loptions[oindex].name, "range") == 0) {
+                    if (sscanf(optarg, "p%lf:p%lf", &p_params->range_low,
+                               &p_params->range_high) != 2 ||
+                        p_params->range_low < 0 ||
+                        p_params->range_high > 100 ||
+                        p_params->range_low > p_params->range_high) {
+                        printf("Bad percentile range %s.\n", optarg);
+                        exit(1);
+                    }
+                    p_params->use_range = true;
+                } else if (strcmp(loptions[oindex].name, "scale") == 0) {
+                    if (       strcmp(optarg, "linear") == 0) { // NOLINT
+                        p_params->to_scale = sns::cs_linear;
+                    } else if (strcmp(optarg, "log") == 0) {
+                        p_params->to_scale = sns::cs_log;
+                    } else if (strcmp(optarg, "symlog") == 0) {
+                        p_params->to_scale = sns::cs_symlog;
+                    } else {
+                        printf("Unknown color scale %s.\n", optarg);
+                        exit(1);
+                    }
+                } else if (strcmp(loptions[oindex].name, "linthresh") == 0) {
+                    sscanf(optarg, "%lf", &p_params->to_linthresh);
+                } else if (strcmp(loptions[oindex].name, "max-memory") == 0) {
+                    p_params->max_memory = parse_memory_size(optarg);
+                } else if (strcmp(loptions[oindex].name, "gif-tiles") == 0) {
+                    sscanf(optarg, "%d", &p_params->gif_tiles);
+                } else if (strcmp(loptions[oindex].name, "animate") == 0) {
+                    p_params->animate_file = optarg;
+                } else if (strcmp(loptions[oindex].name, "delay") == 0) {
+                    sscanf(optarg, "%d", &p_params->frame_delay);
+                } else if (strcmp(loptions[oindex].name, "crop") == 0) {
+                    sscanf(optarg, "%d,%d,%d,%d",
+                           &p_params->crop_x, &p_params->crop_y,
+                           &p_params->crop_width, &p_params->crop_height);
+                } else if (strcmp(loptions[oindex].name, "preview") == 0) {
+                    if (sscanf(optarg, "%d", &p_params->preview_stride) != 1 || // NOLINT
+                        p_params->preview_stride < 1) {
+                        printf("Bad preview stride %s.\n", optarg);
+                        exit(1);
+                    }
+                } else if (strcmp(loptions[oindex].name, "filter") == 0) {
+                    if (!sns::reduce::get_resample_filter(optarg, &p_params->to_filter)) { // NOLINT
+                        printf("Unknown resampling filter %s.\n", optarg);
+                        exit(1);
+                    }
+                } else if (strcmp(loptions[oindex].name, "layer") == 0) {
+                    sscanf(optarg, "%d", &p_params->layer_first);
+                    p_params->layer_last = p_params->layer_first;
+                    p_params->layer_step = 1;
+                } else if (strcmp(loptions[oindex].name, "layers") == 0) {
+                    p_params->layer_step = 1;
+                    sscanf(optarg, "%d:%d:%d", &p_params->layer_first,
+                           &p_params->layer_last, &p_params->layer_step);
                 }
                 break;
             case 's':
@@ -161,9 +311,15 @@ void get_program_options(int argc, char *argv[],
                     p_params->to_height = p_params->to_width;
                 }
                 break;
-            case 't':
-                p_params->bin_type = optarg[0];
+            case 't': {
+                sns::binary_file_type file_type;
+                if (!sns::reduce::get_file_type(optarg, &file_type)) {
+                    printf("Unknown data type %s.\n", optarg);
+                    exit(1);
+                }
+                p_params->bin_type = file_type;
                 break;
+            }
             case 'f':
                 p_params->to_func = optarg;
                 break;
@@ -173,6 +329,9 @@ void get_program_options(int argc, char *argv[],
             case 'e':
                 p_params->to_amp_e = true;
                 break;
+            case 'j':
+                sscanf(optarg, "%d", &p_params->jobs);
+                break;
             case '?':
                 printf("Unknown option %d.\n", optopt);
             case 'h':
@@ -199,58 +358,494 @@ void get_program_options(int argc, char *argv[],
     }
 }
 //---------------------------------------------------------------------------
-void process_file(char *filename_bin, sns::bin2gif_parameters *p_params) {
+/**
+* Extension of produced images
+*/
+const char* get_image_extension(const sns::bin2gif_parameters *p_params) {
+    if (p_params->use_mathgl) {
+        return ".png";
+    } else if (p_params->pyramid) {
+        return ".dzi";
+    }
+
+    return ".gif";
+}
+//---------------------------------------------------------------------------
+/**
+* Print lines of one file collected so far at once, so lines of files
+* converted on several threads are not mixed
+*/
+void print_file_report(std::string *report) {
+    #pragma omp critical(report)
+    {
+        printf("%s", report->c_str());
+        fflush(stdout);
+    }
+    report->clear();
+}
+//---------------------------------------------------------------------------
+void process_file(char *filename_bin,
+                  const sns::bin2gif_parameters *p_params,
+                  sns::stats::manifest *p_manifest) {
     if (sns::fs::is_dir(filename_bin)) {
         if (p_params->verbose) {
             // printf("Directory %s: \033[90G\033[1;33m[Skipped]\033[0m\n", filename_bin); // NOLINT
         }
         return;
-    } else if (strstr(filename_bin, p_params->use_mathgl ? ".png" : ".gif") != NULL) {
+    } else if (strstr(filename_bin, get_image_extension(p_params)) != NULL) {
         if (p_params->verbose) {
             // printf("File %s: \033[90G\033[1;33m[Skipped]\033[0m\n", filename_bin); // NOLINT
         }
         return;
     }
-    char filename_image[1024];
-    char filename_type_fix[32];
-    snprintf(filename_type_fix, sizeof(filename_type_fix),
-             "_%s.%s", p_params->to_func, p_params->use_mathgl ? "png" : "gif");
-    char* ch;
-
-    filename_image[0] = '\0';
-    ch = strrchr(filename_bin, '.');
-    strncat(filename_image, filename_bin, ch - filename_bin);
-
-    strncat(filename_image, filename_type_fix, sizeof(filename_type_fix));
-
-    printf("File %s:\n", filename_bin);
-
-    if (sns::fs::file_exists(filename_image) && !p_params->force) {
-        // printf("\033[90G\033[0;33m[GIF file already exists]\033[0m\n");
-    } else if (sns::visual::convert_binary_file_to_gif(filename_bin, filename_image,
-                                                   p_params) == 0) {
-        printf("  -> %s\n", filename_image);
-        // printf("\033[90G\033[0;32m[Done]\033[0m\n");
-
-        if (p_params->delete_original) {
-            char* rm_cmd = new char[1024];
-            snprintf(rm_cmd, sizeof(rm_cmd), "rm -f %s", filename_bin);
-            system(rm_cmd);
+    // Image per function and selected --axial layer
+    std::vector<int> layers;
+    int layer = 0;
+    if (p_params->layer_first >= 0) {
+        for (layer = p_params->layer_first; layer <= p_params->layer_last;
+             layer += p_params->layer_step) {
+            layers.push_back(layer);
         }
     } else {
-        // printf("\033[90G\033[0;31m[Failed]\033[0m\n");
+        layers.push_back(-1);
+    }
+
+    int funcs_count = p_params->to_funcs_count;
+    std::vector<sns::bin2gif_parameters> params_funcs(funcs_count, *p_params);
+    int f = 0;
+    for (f = 0; f < funcs_count; f++) {
+        params_funcs[f].to_func = p_params->to_funcs[f];
+    }
+
+    std::vector<std::string> filenames_image;
+    char filename_image[1024];
+    char filename_type_fix[64];
+    char* ch = strrchr(filename_bin, '.');
+    unsigned int k = 0;
+
+    for (k = 0; k < layers.size(); k++) {
+        for (f = 0; f < funcs_count; f++) {
+            if (layers[k] >= 0) {
+                snprintf(filename_type_fix, sizeof(filename_type_fix),
+                         "_%s_layer%d%s", p_params->to_funcs[f], layers[k],
+                         get_image_extension(p_params));
+            } else {
+                snprintf(filename_type_fix, sizeof(filename_type_fix),
+                         "_%s%s", p_params->to_funcs[f],
+                         get_image_extension(p_params));
+            }
+
+            filename_image[0] = '\0';
+            strncat(filename_image, filename_bin, ch - filename_bin);
+
+            strncat(filename_image, filename_type_fix, sizeof(filename_type_fix)); // NOLINT
+
+            filenames_image.push_back(filename_image);
+        }
+    }
+
+    std::string report = std::string("File ") + filename_bin + ":\n";
+
+    // Output is rebuilt when input or parameters changed since it was made
+    sns::stats::output_record input;
+    std::vector<sns::stats::output_record> records(funcs_count);
+    std::vector<char*> pending_filenames(filenames_image.size(), NULL);
+    bool pending = false;
+
+    // Input is hashed once for all functions
+    sns::stats::get_input_record(filename_bin, p_params, &input);
+    for (f = 0; f < funcs_count; f++) {
+        records[f] = input;
+        records[f].params = sns::stats::get_params_digest(&params_funcs[f]);
+    }
+
+    for (k = 0; k < filenames_image.size(); k++) {
+        char* filename = const_cast<char*>(filenames_image[k].c_str());
+        bool current = false;
+
+        #pragma omp critical(manifest)
+        current = sns::stats::is_output_current(p_manifest, filename,
+                                                records[k % funcs_count]);
+
+        if (current && !p_params->force) {
+            // printf("\033[90G\033[0;33m[GIF file already exists]\033[0m\n");
+        } else {
+            pending_filenames[k] = filename;
+            pending = true;
+        }
+    }
+
+    if (!pending) {
+        print_file_report(&report);
+        return;
+    }
+
+    // Single job: file name goes before --text data and messages
+    if (p_params->jobs == 1) {
+        print_file_report(&report);
+    }
+
+    std::vector<int> results(filenames_image.size(), 1);
+    int failed = sns::visual::convert_binary_file_to_gifs(filename_bin,
+                                                          &params_funcs[0],
+                                                          funcs_count,
+                                                          &layers[0],
+                                                          layers.size(),
+                                                          &pending_filenames[0], // NOLINT
+                                                          &results[0]);
+
+    for (k = 0; k < pending_filenames.size(); k++) {
+        if (!pending_filenames[k]) {
+            continue;
+        }
+
+        if (results[k] == 0) {
+            report += std::string("  -> ") + pending_filenames[k] + "\n";
+            // printf("\033[90G\033[0;32m[Done]\033[0m\n");
+
+            #pragma omp critical(manifest)
+            if (sns::stats::record_output(p_manifest, pending_filenames[k],
+                                          records[k % funcs_count]) != 0) {
+                report += std::string("Cannot write rebuild manifest for ") +
+                          pending_filenames[k] + ".\n";
+            }
+        } else {
+            // printf("\033[90G\033[0;31m[Failed]\033[0m\n");
+        }
+    }
+
+    print_file_report(&report);
+
+    if (failed == 0 && p_params->delete_original) {
+        char* rm_cmd = new char[1024];
+        snprintf(rm_cmd, sizeof(rm_cmd), "rm -f %s", filename_bin);
+        system(rm_cmd);
     }
 }
 //---------------------------------------------------------------------------
-int main(int argc, char *argv[]) {
+/**
+* File queued for conversion
+*/
+struct batch_item {
+    std::string filename;
+    off_t size;    // input file size
+    off_t memory;  // estimated conversion memory footprint
+};
+//---------------------------------------------------------------------------
+bool compare_batch_items_by_size(const batch_item &a, const batch_item &b) {
+    return a.size > b.size;
+}
+//---------------------------------------------------------------------------
+bool compare_batch_items_by_name(const batch_item &a, const batch_item &b) {
+    return a.filename < b.filename;
+}
+//---------------------------------------------------------------------------
+/**
+* Expand file patterns and directories into list of files to process
+* @return int 0 on success, 1 if directory cannot be read
+*/
+int collect_files(sns::bin2gif_parameters *p_params,
+                  std::vector<batch_item> *items) {
     unsigned int i = 0, j = 0;
+    char filename_bin[1024];
+    batch_item item;
+
+    glob_t globbuf;
+    globbuf.gl_offs = 0;
+
+    for (i = 0; i < p_params->file_patterns_count; i++) {
+        glob(p_params->file_patterns[i], GLOB_DOOFFS, NULL, &globbuf);
+
+        for (j = 0; j < globbuf.gl_pathc; j++) {
+            if (sns::fs::is_dir(globbuf.gl_pathv[j])) {  // Directory
+                dirent *de;
+                DIR *dp;
+
+                if (!(dp = opendir(globbuf.gl_pathv[j]))) {
+                    // printf("\033[0;31m[Error:\033[0m Cannot read directory %s.\n", globbuf.gl_pathv[j]); // NOLINT
+                    globfree(&globbuf);
+                    return 1;
+                }
+
+                printf("Processing %s:\n", globbuf.gl_pathv[j]);
+
+                while ((de = readdir(dp))) {
+                    // Skip hidden files, like .bin2gif_index
+                    if (de->d_name[0] == '.') {
+                        continue;
+                    }
+
+                    snprintf(filename_bin, sizeof(filename_bin),
+                             "%s", globbuf.gl_pathv[j]);
+                    if (filename_bin[strlen(filename_bin)-1] != '/') {
+                        strncat(filename_bin, "/",
+                                sizeof(filename_bin) - strlen(filename_bin) - 1); // NOLINT
+                    }
+                    strncat(filename_bin, de->d_name,
+                            sizeof(filename_bin) - strlen(filename_bin) - 1);
+
+                    item.filename = filename_bin;
+                    items->push_back(item);
+                }
+
+                closedir(dp);
+            } else {  // Maybe file?
+                item.filename = globbuf.gl_pathv[j];
+                items->push_back(item);
+            }
+        }
+
+        globfree(&globbuf);
+    }
+
+    return 0;
+}
+//---------------------------------------------------------------------------
+/**
+* Convert files on several threads, largest first.
+* New file is started only while summary estimated memory of files in flight
+* fits into --max-memory; single file is always allowed to run.
+*/
+void process_files_parallel(std::vector<batch_item> *items,
+                            const sns::bin2gif_parameters *p_params,
+                            sns::stats::manifest *p_manifest) {
+    size_t i = 0;
+
+    for (i = 0; i < items->size(); i++) {
+        char* filename = const_cast<char*>((*items)[i].filename.c_str());
+        (*items)[i].size = sns::fs::file_size(filename);
+        (*items)[i].memory = sns::visual::estimate_memory_usage(filename,
+                                                                 p_params);
+    }
+
+    std::stable_sort(items->begin(), items->end(),
+                     compare_batch_items_by_size);
+
+    std::vector<bool> started(items->size(), false);
+    size_t items_left = items->size();
+    off_t memory_in_flight = 0;
+    int files_in_flight = 0;
+
+    omp_lock_t lock;
+    omp_init_lock(&lock);
+
+    #pragma omp parallel num_threads(p_params->jobs)
+    {
+        for (;;) {
+            int next = -1;
+            bool finished = false;
+
+            omp_set_lock(&lock);
+            if (items_left == 0) {
+                finished = true;
+            } else {
+                for (size_t k = 0; k < items->size(); k++) {
+                    if (started[k]) {
+                        continue;
+                    }
+                    if (files_in_flight == 0 || p_params->max_memory <= 0 ||
+                        memory_in_flight + (*items)[k].memory <=
+                            p_params->max_memory) {
+                        next = k;
+                        break;
+                    }
+                }
+                if (next >= 0) {
+                    started[next] = true;
+                    items_left--;
+                    memory_in_flight += (*items)[next].memory;
+                    files_in_flight++;
+                }
+            }
+            omp_unset_lock(&lock);
 
-    char *filename_bin = new char[1024];
-    if (!filename_bin) {
-        printf("Error: Not enough memory for temporary string o_0. \033[70G\033[0;31m[Failed]\033[0m\n"); // NOLINT
+            if (finished) {
+                break;
+            }
+            if (next < 0) {
+                // Wait for running conversions to free memory budget
+                usleep(10000);
+                continue;
+            }
+
+            process_file(const_cast<char*>((*items)[next].filename.c_str()),
+                         p_params, p_manifest);
+
+            omp_set_lock(&lock);
+            memory_in_flight -= (*items)[next].memory;
+            files_in_flight--;
+            omp_unset_lock(&lock);
+        }
+    }
+
+    omp_destroy_lock(&lock);
+}
+//---------------------------------------------------------------------------
+/**
+* Check that file is data file, not directory or produced image
+*/
+bool is_input_file(char *filename_bin,
+                   const sns::bin2gif_parameters *p_params) {
+    return !sns::fs::is_dir(filename_bin) &&
+           strstr(filename_bin, get_image_extension(p_params)) == NULL;
+}
+//---------------------------------------------------------------------------
+/**
+* First pass of --global-range: find data range of every file, reusing
+* ranges stored in index of file directory for unchanged files, and set
+* range of all files into parameters
+* @return int 0 on success, 1 if some file cannot be read
+*/
+int find_global_range(const std::vector<batch_item> *items,
+                      sns::bin2gif_parameters *p_params) {
+    std::map<std::string, std::vector<sns::stats::file_stats> > indexes;
+    std::vector<sns::stats::file_stats> files;
+    std::vector<std::string> filenames;
+    std::vector<std::string> index_filenames;
+    std::vector<int> to_scan;
+    std::string key = sns::stats::get_stats_key(p_params);
+    unsigned int i = 0;
+    int k = 0, failed = 0;
+
+    // Known ranges
+    for (i = 0; i < items->size(); i++) {
+        char *filename_bin = const_cast<char*>((*items)[i].filename.c_str());
+
+        if (!is_input_file(filename_bin, p_params)) {
+            continue;
+        }
+
+        std::string filename_index =
+            sns::stats::get_index_filename((*items)[i].filename);
+        if (indexes.find(filename_index) == indexes.end()) {
+            if (sns::stats::load_index(filename_index.c_str(),
+                                       &indexes[filename_index]) != 0) {
+                printf("Index %s is damaged, files will be scanned again.\n", // NOLINT
+                       filename_index.c_str());
+            }
+        }
+
+        sns::stats::file_stats current;
+        const char *name = strrchr(filename_bin, '/');
+        current.name = name ? name + 1 : filename_bin;
+        current.size = sns::fs::file_size(filename_bin);
+        current.mtime = sns::fs::file_mtime(filename_bin);
+        current.key = key;
+        current.min = 0;
+        current.max = 0;
+
+        const sns::stats::file_stats *known =
+            sns::stats::find_stats(indexes[filename_index], current);
+        if (known) {
+            current.min = known->min;
+            current.max = known->max;
+        } else {
+            to_scan.push_back(files.size());
+        }
+
+        files.push_back(current);
+        filenames.push_back((*items)[i].filename);
+        index_filenames.push_back(filename_index);
+    }
+
+    if (files.empty()) {
+        printf("No files to find range.\n");
         return 1;
     }
 
+    // Scan new and changed files, without text export
+    sns::bin2gif_parameters scan_params = *p_params;
+    scan_params.export_text = false;
+
+    #pragma omp parallel for num_threads(p_params->jobs) schedule(dynamic, 1)
+    for (k = 0; k < static_cast<int>(to_scan.size()); k++) {
+        sns::stats::file_stats *p_file = &files[to_scan[k]];
+
+        if (sns::visual::find_file_range(
+                const_cast<char*>(filenames[to_scan[k]].c_str()),
+                &scan_params, &p_file->min, &p_file->max) != 0) {
+            #pragma omp atomic
+            failed++;
+        }
+    }
+
+    if (failed) {
+        return 1;
+    }
+
+    // Store new ranges
+    for (k = 0; k < static_cast<int>(to_scan.size()); k++) {
+        sns::stats::update_stats(&indexes[index_filenames[to_scan[k]]],
+                                 files[to_scan[k]]);
+    }
+
+    std::map<std::string, std::vector<sns::stats::file_stats> >::iterator it;
+    for (it = indexes.begin(); it != indexes.end() && !to_scan.empty(); ++it) {
+        if (sns::stats::save_index(it->first.c_str(), it->second) != 0) {
+            printf("Cannot write index %s.\n", it->first.c_str());
+        }
+    }
+
+    p_params->global_min = files[0].min;
+    p_params->global_max = files[0].max;
+    for (i = 1; i < files.size(); i++) {
+        p_params->global_min = std::min(p_params->global_min, files[i].min);
+        p_params->global_max = std::max(p_params->global_max, files[i].max);
+    }
+
+    printf("Global range: %lf .. %lf, %d of %d files scanned\n",
+           p_params->global_min, p_params->global_max,
+           static_cast<int>(to_scan.size()), static_cast<int>(files.size()));
+
+    return 0;
+}
+//---------------------------------------------------------------------------
+/**
+* Convert files in name order into frames of one animated GIF,
+* images are skipped as in process_file
+* @return int 0 on success, 1 on error
+*/
+int process_animation(std::vector<batch_item> *items,
+                      const sns::bin2gif_parameters *p_params) {
+    std::vector<char*> filenames;
+    unsigned int i = 0;
+
+    std::sort(items->begin(), items->end(), compare_batch_items_by_name);
+
+    for (i = 0; i < items->size(); i++) {
+        char *filename_bin = const_cast<char*>((*items)[i].filename.c_str());
+
+        if (!is_input_file(filename_bin, p_params)) {
+            continue;
+        }
+        filenames.push_back(filename_bin);
+    }
+
+    if (filenames.empty()) {
+        printf("No files to animate.\n");
+        return 1;
+    }
+
+    if (sns::fs::file_exists(p_params->animate_file) && !p_params->force) {
+        printf("File %s already exists.\n", p_params->animate_file);
+        return 1;
+    }
+
+    if (sns::visual::convert_binary_files_to_animated_gif(&filenames[0],
+                                                          filenames.size(),
+                                                          p_params->animate_file, // NOLINT
+                                                          p_params) != 0) {
+        return 1;
+    }
+
+    printf("  -> %s\n", p_params->animate_file);
+
+    return 0;
+}
+//---------------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    unsigned int i = 0, j = 0;
+
     glob_t globbuf;
     globbuf.gl_offs = 0;
 
@@ -270,39 +865,127 @@ int main(int argc, char *argv[]) {
     p_params.autodetect_bin_sizes = true;
     p_params.bin_width = -1;   // Autodetect
     p_params.bin_height = -1;  // Autodetect
-    p_params.bin_type = ' ';   // Autodetect
+    p_params.bin_type = -1;    // Autodetect
+    p_params.byteswap = false;
     p_params.bin_axial = false;      // Standart square matrix
     p_params.bin_axial_all = false;  // Standart square matrix
+    p_params.layer_first = -1;       // Central time layer
+    p_params.layer_last = -1;
+    p_params.layer_step = 1;
     p_params.export_text = false;
     p_params.use_mathgl = false;
+    p_params.stream = false;
+    p_params.fast_math = false;
+    p_params.pyramid = false;
 
 
     p_params.bin_header = 0;
     p_params.bin_footer = 0;
 
+    p_params.crop_x = 0;
+    p_params.crop_y = 0;
+    p_params.crop_width = 0;  // Whole matrix
+    p_params.crop_height = 0;
+    p_params.preview_stride = 1;
+
     p_params.to_width = -1;   // No resize
     p_params.to_height = -1;  // No resize
+    p_params.to_filter = sns::rs_area;
     p_params.to_reflect = false;
 
     p_params.to_func = const_cast<char*>("real");
+    p_params.to_funcs = NULL;
+    p_params.to_funcs_count = 0;
     p_params.to_amp = -1;
     p_params.to_amp_e = false;
     p_params.to_use_min = false;
     p_params.to_use_max = false;
+    p_params.to_min = 0;
+    p_params.to_max = 0;
+    p_params.use_range = false;  // Exact data range
+    p_params.range_low = 0;
+    p_params.range_high = 100;
+    p_params.to_scale = sns::cs_linear;
+    p_params.to_linthresh = 0;  // Auto
 
     p_params.palette_file = 0;
 
+    p_params.jobs = 1;        // Convert files one by one
+    p_params.max_memory = 0;  // No memory limit
+    p_params.gif_tiles = 1;   // Single image block
+
+    p_params.animate_file = 0;  // Image per file
+    p_params.frame_delay = 10;
+
+    p_params.hash_inputs = false;   // Size and mtime only
+    p_params.use_cache = false;
+    p_params.global_range = false;  // Range of every file
+    p_params.global_min = 0;
+    p_params.global_max = 0;
+
     // Parse program command line options
     get_program_options(argc, argv, &p_params);
     if (p_params.bin_width > 0 && p_params.bin_height > 0) {
         p_params.autodetect_bin_sizes = false;
     }
 
+    // Split function list, first function is used where only one can be
+    char* funcs = new char[strlen(p_params.to_func) + 1];
+    strcpy(funcs, p_params.to_func);  // NOLINT
+    p_params.to_funcs = new char*[strlen(funcs)/2 + 1];
+    for (char* func = strtok(funcs, ","); func;
+         func = strtok(NULL, ",")) {
+        p_params.to_funcs[p_params.to_funcs_count++] = func;
+    }
+    if (p_params.to_funcs_count == 0) {
+        printf("No function given by --func.\n");
+        return 1;
+    }
+    p_params.to_func = p_params.to_funcs[0];
+
+    if (p_params.to_funcs_count > 1 &&
+        (p_params.animate_file || p_params.global_range)) {
+        printf("Options --animate and --global-range are used with one function only.\n"); // NOLINT
+        return 1;
+    }
+
+    if (p_params.pyramid && (p_params.animate_file || p_params.use_mathgl)) {
+        printf("Option --pyramid is not used with --animate and --mathgl.\n"); // NOLINT
+        return 1;
+    }
+
     if (p_params.bin_axial && p_params.bin_axial_all) {
         printf("You should use only one option at same time: --axial OR --axial-all"); // NOLINT
         return 1;
     }
 
+    if ((p_params.crop_width > 0 || p_params.preview_stride > 1) &&
+        (p_params.bin_axial || p_params.bin_axial_all)) {
+        printf("Options --crop and --preview are used with square matrix only.\n"); // NOLINT
+        return 1;
+    }
+
+    if ((p_params.crop_width != 0 || p_params.crop_height != 0) &&
+        (p_params.crop_width <= 0 || p_params.crop_height <= 0 ||
+         p_params.crop_x < 0 || p_params.crop_y < 0)) {
+        printf("Bad crop region %d,%d,%d,%d.\n", p_params.crop_x,
+               p_params.crop_y, p_params.crop_width, p_params.crop_height);
+        return 1;
+    }
+
+    if (p_params.layer_first >= 0 && !p_params.bin_axial) {
+        printf("Options --layer and --layers are used with --axial only.\n");
+        return 1;
+    }
+
+    if (p_params.layer_first >= 0 &&
+        (p_params.layer_last < p_params.layer_first ||
+         p_params.layer_step < 1)) {
+        printf("Bad layers range %d:%d:%d.\n", p_params.layer_first,
+               p_params.layer_last, p_params.layer_step);
+        return 1;
+    }
+
     // Confirm originals deletion
     if (p_params.delete_original) {
         printf("Are you sure to delete original binary files after convertion[y/N]: "); // NOLINT
@@ -318,7 +1001,10 @@ int main(int argc, char *argv[]) {
     }
 
     // Init color palette
-    sns::visual::init_color_palette(p_params.palette_file);
+    if (sns::visual::init_color_palette(p_params.palette_file,
+                                        &p_params.palette) != 0) {
+        return 1;
+    }
 
     // Debug {{{
     if (p_params.debug) {
@@ -346,37 +1032,42 @@ int main(int argc, char *argv[]) {
     }
     // Debug }}}
 
-    for (i = 0; i < p_params.file_patterns_count; i++) {
-        glob(p_params.file_patterns[i], GLOB_DOOFFS, NULL, &globbuf);
+    std::vector<batch_item> items;
+    if (collect_files(&p_params, &items) != 0) {
+        return 1;
+    }
 
-        for (j = 0; j < globbuf.gl_pathc; j++) {
-            if (sns::fs::is_dir(globbuf.gl_pathv[j])) {  // Directory
-                dirent *de;
-                DIR *dp;
+    if (p_params.jobs <= 0) {
+        p_params.jobs = omp_get_max_threads();
+    }
 
-                if (!(dp = opendir(globbuf.gl_pathv[j]))) {
-                    // printf("\033[0;31m[Error:\033[0m Cannot read directory %s.\n", globbuf.gl_pathv[j]); // NOLINT
-                    return 1;
-                }
+    if (p_params.gif_tiles <= 0) {
+        p_params.gif_tiles = omp_get_max_threads();
+    }
 
-                printf("Processing %s:\n", globbuf.gl_pathv[j]);
+    if (p_params.global_range) {
+        if (find_global_range(&items, &p_params) != 0) {
+            return 1;
+        }
+    }
 
-                while ((de = readdir(dp))) {
-                    snprintf(filename_bin, sizeof(filename_bin),
-                             "%s", globbuf.gl_pathv[j]);
-                    if (filename_bin[strlen(filename_bin)-1] != '/') {
-                        strcpy(filename_bin + strlen(filename_bin), "/");
-                    }
-                    strcpy(filename_bin + strlen(filename_bin), de->d_name);
+    if (p_params.animate_file) {
+        return process_animation(&items, &p_params);
+    }
 
-                    process_file(filename_bin, &p_params);
-                }
+    sns::stats::manifest manifest;
 
-                closedir(dp);
-            } else {  // Maybe file?
-                process_file(globbuf.gl_pathv[j], &p_params);
-            }
+    if (p_params.jobs == 1) {
+        for (i = 0; i < items.size(); i++) {
+            process_file(const_cast<char*>(items[i].filename.c_str()),
+                         &p_params, &manifest);
         }
+    } else {
+        process_files_parallel(&items, &p_params, &manifest);
+    }
+
+    if (sns::stats::save_manifests(&manifest) != 0) {
+        printf("Cannot write rebuild manifest.\n");
     }
 
     return 0;
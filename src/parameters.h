@@ -7,20 +7,56 @@ See license text in LICENSE file
 #ifndef SRC_PARAMETERS_H_
 #define SRC_PARAMETERS_H_
 //---------------------------------------------------------------------------
+#include <sys/types.h>
+//---------------------------------------------------------------------------
 namespace sns {
     /**
     * Enumerate for binary file types
     */
     enum binary_file_type {
         t_double,              // double binary data
-        t_complex_double       // std::complex<double> binary data
+        t_complex_double,      // std::complex<double> binary data
+        t_float,               // float binary data
+        t_complex_float,       // std::complex<float> binary data
+        t_int16,               // int16_t binary data
+        t_int32                // int32_t binary data
+    };
+
+    /**
+    * Enumerate for resampling filters, see --filter
+    */
+    enum resample_filter {
+        rs_area,               // average of covered input area
+        rs_bilinear,           // triangle filter
+        rs_lanczos3,           // sinc windowed by sinc, 3 lobes
+        rs_max,                // maximum of covered input area
+        rs_min                 // minimum of covered input area
+    };
+
+    /**
+    * Enumerate for color scales, see --scale
+    */
+    enum color_scale {
+        cs_linear,             // colors linear in value
+        cs_log,                // colors linear in log10 of value
+        cs_symlog              // log10 of magnitude, linear near zero
     };
 
+    /**
+    * Color palette, 256 RGB colors
+    */
+    struct color_palette {
+        int colors[256][3];
+    };
+
+    /**
+    * Program options, read-only while files are converted
+    */
     struct bin2gif_parameters {
         unsigned int file_patterns_count;
         char** file_patterns;
 
-        char* palette_file;
+        char* palette_file;  // --palette name or file, NULL - grayscale
 
         bool delete_original;
 
@@ -30,34 +66,96 @@ namespace sns {
 
         bool export_text;
         bool use_mathgl;
+        bool stream;        // read square matrix by row stripes
+        bool fast_math;     // approximate phase for previews
+        bool pyramid;       // deep zoom tiles of every 2x level
+
+        int jobs;           // files converted in parallel
+        off_t max_memory;   // memory budget for parallel jobs, 0 - no limit
+        int gif_tiles;      // GIF image blocks encoded in parallel
+
+        char* animate_file;  // all files as frames of one animated GIF
+        int frame_delay;     // animation frame delay, 1/100 s
+
+        bool hash_inputs;    // check input contents for rebuild, not only mtime
+        bool use_cache;      // keep reduced data to render again without input
+        bool global_range;   // one data range for all files
+        double global_min;   // found by first pass over files
+        double global_max;
 
         int bin_width;
         int bin_height;
         bool autodetect_bin_sizes;
-        char bin_type;
-        binary_file_type file_type;
+        int bin_type;       // binary_file_type, -1 - autodetect
+        bool byteswap;      // data is big-endian
 
         bool bin_axial;
         bool bin_axial_all;
-        double st;
-        double sr;
-
+        int layer_first;    // --axial time layers, -1 - central layer only
+        int layer_last;
+        int layer_step;
 
         int bin_header;
         int bin_footer;
 
+        int crop_x;         // region of square matrix to draw,
+        int crop_y;         // crop_width 0 - whole matrix
+        int crop_width;
+        int crop_height;
+        int preview_stride;  // draw every Nth row and column, 1 - all
+
         int to_width;
         int to_height;
+        resample_filter to_filter;
         bool to_reflect;
         bool to_fixphase;
 
         char* to_func;
+        char** to_funcs;     // all --func functions, to_func is the first
+        int to_funcs_count;
         double to_amp;
         bool to_amp_e;
         double to_min;
         double to_max;
         bool to_use_min;
         bool to_use_max;
+        color_scale to_scale;
+        double to_linthresh;  // --scale symlog linear range, 0 - auto
+        bool use_range;      // data range by percentiles, see --range
+        double range_low;    // percentiles, 0..100
+        double range_high;
+
+        color_palette palette;
+    };
+
+    /**
+    * Per-file conversion state, detected from file and parameters
+    */
+    struct bin2gif_job {
+        const bin2gif_parameters *p_params;
+
+        binary_file_type file_type;
+
+        int bin_width;   // size of data to reduce: matrix, or its region
+        int bin_height;
+
+        int matrix_width;   // row length of square matrix in file
+        int region_x;       // region of matrix read, see --crop
+        int region_y;
+        int region_width;
+        int region_height;
+        int region_stride;  // see --preview
+
+        int to_width;
+        int to_height;
+
+        double sr;  // axial data radius
+        double st;  // axial data time range
+        int layer;     // --axial time layer, -1 - central layer
+        int axial_fd;  // open axial input, -1 if reader opens file itself
+
+        void *map_base;     // input file mapping, NULL if data was read
+        size_t map_length;
     };
 }
 //---------------------------------------------------------------------------
@@ -6,6 +6,14 @@ See license text in LICENSE file
 //---------------------------------------------------------------------------
 #include "./util_fs.h"
 //---------------------------------------------------------------------------
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+//---------------------------------------------------------------------------
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+//---------------------------------------------------------------------------
 namespace sns {
     namespace fs {
         bool file_exists(char* filename) {
@@ -38,8 +46,123 @@ namespace sns {
             return st.st_size;
         }
 
-        bool create_dir(char* dirname) {
-            return mkdir(dirname, S_IRWXU | S_IRGRP | S_IROTH | S_IXOTH);
+        time_t file_mtime(char* filename) {
+            struct stat st;
+
+            if (stat(filename, &st) != 0) {
+                return 0;
+            }
+
+            return st.st_mtime;
+        }
+
+        /**
+        * Fast non-cryptographic 64-bit hash of file contents,
+        * 8-byte words are mixed by multiply and xor-shift
+        * @return unsigned long long Hash, 0 if file cannot be read
+        */
+        unsigned long long file_hash(char* filename) {
+            const size_t block_size = 1 << 20;
+            const unsigned long long prime = 0x9e3779b97f4a7c15ULL;
+            unsigned long long h = prime, w = 0;
+            size_t n = 0, i = 0;
+
+            FILE *fp = fopen(filename, "rb");
+            if (!fp) {
+                return 0;
+            }
+
+            unsigned char *block = new unsigned char[block_size];
+
+            while ((n = fread(block, 1, block_size, fp)) > 0) {
+                for (i = 0; i + 8 <= n; i += 8) {
+                    memcpy(&w, block + i, 8);
+                    h = (h ^ w)*prime;
+                    h ^= h >> 29;
+                }
+                for (; i < n; i++) {
+                    h = (h ^ block[i])*prime;
+                }
+                h ^= n;
+            }
+
+            delete[] block;
+            fclose(fp);
+
+            return h ? h : 1;
+        }
+
+        /**
+        * Read exactly length bytes at offset, file position is not used,
+        * so one descriptor may be read from several places
+        * @return int 0 on success
+        */
+        int read_at(int fd, void* buffer, size_t length, off_t offset) {
+            char *p = static_cast<char*>(buffer);
+
+            while (length > 0) {
+                ssize_t n = pread(fd, p, length, offset);
+
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return 1;
+                }
+
+                p += n;
+                length -= n;
+                offset += n;
+            }
+
+            return 0;
+        }
+
+        /**
+        * Map whole file read-only for sequential reading
+        * @return void* Mapping address, NULL on error
+        */
+        void* map_file(char* filename, size_t* p_length) {
+            struct stat st;
+            void* address = NULL;
+
+            int fd = open(filename, O_RDONLY);
+            if (fd < 0) {
+                return NULL;
+            }
+
+            if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+                close(fd);
+                return NULL;
+            }
+
+            address = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+
+            if (address == MAP_FAILED) {
+                return NULL;
+            }
+
+            madvise(address, st.st_size, MADV_SEQUENTIAL);
+
+            *p_length = st.st_size;
+            return address;
+        }
+
+        void unmap_file(void* address, size_t length) {
+            munmap(address, length);
+        }
+
+        /**
+        * Create directory, existing one is not an error
+        * @return int 0 on success
+        */
+        int create_dir(char* dirname) {
+            if (mkdir(dirname, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) { // NOLINT
+                return 0;
+            }
+
+            return (errno == EEXIST && is_dir(dirname)) ? 0 : 1;
         }
     }
 }
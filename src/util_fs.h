@@ -8,12 +8,19 @@ See license text in LICENSE file
 #define SRC_UTIL_FS_H_
 //---------------------------------------------------------------------------
 #include <sys/stat.h>
+#include <sys/types.h>
 //---------------------------------------------------------------------------
 namespace sns {
     namespace fs {
         bool file_exists(char* filename);
         bool is_dir(char* filename);
         off_t file_size(char* filename);
+        time_t file_mtime(char* filename);
+        unsigned long long file_hash(char* filename);
+        int read_at(int fd, void* buffer, size_t length, off_t offset);
+        int create_dir(char* dirname);
+        void* map_file(char* filename, size_t* p_length);
+        void unmap_file(void* address, size_t length);
     }
 }
 //---------------------------------------------------------------------------
@@ -0,0 +1,424 @@
+/*
+Copyright (C) 2009, Oleg Efimov <efimovov@yandex.ru>
+
+See license text in LICENSE file
+*/
+//---------------------------------------------------------------------------
+#include "./util_gif.h"
+//---------------------------------------------------------------------------
+#include <cstring>
+//---------------------------------------------------------------------------
+namespace sns {
+    namespace gif {
+        // Palette indexes are 8-bit, so codes 256 and 257 are clear and
+        // end of information, and the first string code is 258
+        const int lzw_min_code_size = 8;
+        const int lzw_clear_code = 1 << lzw_min_code_size;
+        const int lzw_end_code = lzw_clear_code + 1;
+        const int lzw_max_code = 4095;
+
+        // Table entry is (generation << 20 | prefix << 8 | pixel)
+        const int lzw_key_bits = 20;
+        const unsigned int lzw_key_mask = (1u << lzw_key_bits) - 1;
+        const unsigned int lzw_max_generation = (1u << (32 - lzw_key_bits)) - 1; // NOLINT
+
+        // Encoded data is written to file by blocks of this size
+        const size_t flush_size = 1 << 20;
+
+        //-------------------------------------------------------------------
+        // LZW encoder
+        //-------------------------------------------------------------------
+        void put_lzw_byte(lzw_encoder *p_lzw, unsigned char byte) {
+            if (p_lzw->raw) {
+                p_lzw->out->push_back(byte);
+                return;
+            }
+
+            p_lzw->block[1 + p_lzw->block_size++] = byte;
+
+            // Data is stored in sub-blocks of up to 255 bytes
+            if (p_lzw->block_size == 255) {
+                p_lzw->block[0] = 255;
+                p_lzw->out->insert(p_lzw->out->end(),
+                                   p_lzw->block, p_lzw->block + 256);
+                p_lzw->block_size = 0;
+            }
+        }
+
+        void put_lzw_code(lzw_encoder *p_lzw, int code) {
+            p_lzw->bits |= static_cast<unsigned long long>(code)
+                           << p_lzw->bits_count;
+            p_lzw->bits_count += p_lzw->code_size;
+
+            while (p_lzw->bits_count >= 8) {
+                put_lzw_byte(p_lzw, p_lzw->bits & 0xff);
+                p_lzw->bits >>= 8;
+                p_lzw->bits_count -= 8;
+            }
+
+            // Decoder adds its entry one code later, so code size grows
+            // when the next code to be added doesn't fit
+            if (p_lzw->next_code >= (1 << p_lzw->code_size) &&
+                p_lzw->code_size < 12) {
+                p_lzw->code_size++;
+            }
+        }
+
+        void clear_lzw_table(lzw_encoder *p_lzw) {
+            if (p_lzw->generation == lzw_max_generation) {
+                memset(p_lzw->table_keys, 0, sizeof(p_lzw->table_keys));
+                p_lzw->generation = 0;
+            }
+            p_lzw->generation++;
+
+            p_lzw->next_code = lzw_end_code + 1;
+            p_lzw->code_size = lzw_min_code_size + 1;
+        }
+
+        /**
+        * Initialize encoder, once for any number of images
+        */
+        void init_lzw(lzw_encoder *p_lzw) {
+            memset(p_lzw->table_keys, 0, sizeof(p_lzw->table_keys));
+            p_lzw->generation = 0;
+
+            p_lzw->out = NULL;
+            p_lzw->raw = false;
+        }
+
+        /**
+        * Start code stream into out, without minimum code size
+        */
+        void start_lzw_codes(lzw_encoder *p_lzw,
+                             std::vector<unsigned char> *out, bool raw) {
+            p_lzw->out = out;
+            p_lzw->raw = raw;
+
+            p_lzw->prefix = -1;
+            p_lzw->bits = 0;
+            p_lzw->bits_count = 0;
+            p_lzw->block_size = 0;
+
+            clear_lzw_table(p_lzw);
+        }
+
+        /**
+        * Start image data: minimum code size and clear code
+        * @param out Encoded sub-blocks are appended here
+        */
+        void begin_lzw(lzw_encoder *p_lzw, std::vector<unsigned char> *out) {
+            out->push_back(lzw_min_code_size);
+
+            start_lzw_codes(p_lzw, out, false);
+            put_lzw_code(p_lzw, lzw_clear_code);
+        }
+
+        /**
+        * Encode next pixels of image, any number at once
+        */
+        void encode_lzw(lzw_encoder *p_lzw,
+                        const unsigned char *indexes, size_t count) {
+            unsigned int *keys = p_lzw->table_keys;
+            unsigned short *codes = p_lzw->table_codes;
+            unsigned int generation = p_lzw->generation << lzw_key_bits;
+            int prefix = p_lzw->prefix;
+            size_t k = 0;
+
+            if (count == 0) {
+                return;
+            }
+
+            if (prefix < 0) {
+                prefix = indexes[k++];
+            }
+
+            for (; k < count; k++) {
+                unsigned int key = (prefix << 8) | indexes[k];
+                unsigned int h = (key*2654435761u) >> (32 - lzw_table_bits);
+
+                // Linear probing, entries of previous generations are free
+                while (keys[h] != (generation | key) &&
+                       (keys[h] & ~lzw_key_mask) == generation) {
+                    h = (h + 1) & (lzw_table_size - 1);
+                }
+
+                if (keys[h] == (generation | key)) {
+                    prefix = codes[h];
+                    continue;
+                }
+
+                put_lzw_code(p_lzw, prefix);
+
+                if (p_lzw->next_code < lzw_max_code) {
+                    keys[h] = generation | key;
+                    codes[h] = p_lzw->next_code++;
+                } else {
+                    // Table is full, start again
+                    put_lzw_code(p_lzw, lzw_clear_code);
+                    clear_lzw_table(p_lzw);
+                    generation = p_lzw->generation << lzw_key_bits;
+                }
+
+                prefix = indexes[k];
+            }
+
+            p_lzw->prefix = prefix;
+        }
+
+        /**
+        * Put last byte, last sub-block and block terminator
+        */
+        void finish_lzw_blocks(lzw_encoder *p_lzw) {
+            if (p_lzw->bits_count > 0) {
+                put_lzw_byte(p_lzw, p_lzw->bits & 0xff);
+            }
+
+            if (p_lzw->block_size > 0) {
+                p_lzw->block[0] = p_lzw->block_size;
+                p_lzw->out->insert(p_lzw->out->end(), p_lzw->block,
+                                   p_lzw->block + 1 + p_lzw->block_size);
+            }
+            p_lzw->out->push_back(0);
+
+            p_lzw->out = NULL;
+        }
+
+        /**
+        * Finish image data: last string, end code and block terminator
+        */
+        void end_lzw(lzw_encoder *p_lzw) {
+            if (p_lzw->prefix >= 0) {
+                put_lzw_code(p_lzw, p_lzw->prefix);
+            }
+            put_lzw_code(p_lzw, lzw_end_code);
+
+            finish_lzw_blocks(p_lzw);
+        }
+
+        //-------------------------------------------------------------------
+        // GIF writer
+        //-------------------------------------------------------------------
+        void put_word(std::vector<unsigned char> *out, int value) {
+            out->push_back(value & 0xff);
+            out->push_back((value >> 8) & 0xff);
+        }
+
+        void flush_gif(gif_writer *p_gif) {
+            if (!p_gif->buffer.empty()) {
+                fwrite(&p_gif->buffer[0], 1, p_gif->buffer.size(),
+                       p_gif->fp);
+                p_gif->buffer.clear();
+            }
+        }
+
+        /**
+        * Create file, write header, logical screen and global color table
+        * @return int Zero on success
+        */
+        int open_gif(gif_writer *p_gif, const char *filename,
+                     int width, int height, const color_palette *p_palette) {
+            int i = 0;
+
+            p_gif->fp = fopen(filename, "wb");
+            if (!p_gif->fp) {
+                return 1;
+            }
+
+            p_gif->buffer.reserve(flush_size + 4096);
+
+            p_gif->p_lzw = new lzw_encoder;
+            init_lzw(p_gif->p_lzw);
+
+            const char *header = "GIF89a";
+            p_gif->buffer.insert(p_gif->buffer.end(), header, header + 6);
+
+            put_word(&p_gif->buffer, width);
+            put_word(&p_gif->buffer, height);
+            // Global color table of 256 colors, 8 bits per primary color
+            p_gif->buffer.push_back(0xf7);
+            p_gif->buffer.push_back(0);  // background color
+            p_gif->buffer.push_back(0);  // pixel aspect ratio
+
+            for (i = 0; i < 256; i++) {
+                p_gif->buffer.push_back(p_palette->colors[i][0]);
+                p_gif->buffer.push_back(p_palette->colors[i][1]);
+                p_gif->buffer.push_back(p_palette->colors[i][2]);
+            }
+
+            return 0;
+        }
+
+        /**
+        * Application extension to repeat animation forever
+        */
+        void write_loop(gif_writer *p_gif) {
+            const char *application = "\x21\xff\x0bNETSCAPE2.0\x03\x01";
+            p_gif->buffer.insert(p_gif->buffer.end(),
+                                 application, application + 16);
+            put_word(&p_gif->buffer, 0);
+            p_gif->buffer.push_back(0);
+        }
+
+        /**
+        * Graphic control extension for next image: frame is left in place
+        * and later frames are drawn over it
+        * @param delay Delay after frame in 1/100 s
+        */
+        void write_frame_control(gif_writer *p_gif, int delay) {
+            p_gif->buffer.push_back(0x21);
+            p_gif->buffer.push_back(0xf9);
+            p_gif->buffer.push_back(4);
+            p_gif->buffer.push_back(1 << 2);  // do not dispose
+            put_word(&p_gif->buffer, delay);
+            p_gif->buffer.push_back(0);  // transparent color, not used
+            p_gif->buffer.push_back(0);
+        }
+
+        /**
+        * Image descriptor, image uses global color table
+        * and is not interlaced
+        */
+        void put_image_descriptor(std::vector<unsigned char> *out,
+                                  int left, int top, int width, int height) {
+            out->push_back(0x2c);
+            put_word(out, left);
+            put_word(out, top);
+            put_word(out, width);
+            put_word(out, height);
+            out->push_back(0);
+        }
+
+        /**
+        * Write image descriptor and start image data
+        */
+        void begin_image(gif_writer *p_gif,
+                         int left, int top, int width, int height) {
+            put_image_descriptor(&p_gif->buffer, left, top, width, height);
+            begin_lzw(p_gif->p_lzw, &p_gif->buffer);
+        }
+
+        /**
+        * Encode next pixels of image, usually one or several rows
+        */
+        void write_pixels(gif_writer *p_gif,
+                          const unsigned char *indexes, size_t count) {
+            encode_lzw(p_gif->p_lzw, indexes, count);
+
+            if (p_gif->buffer.size() >= flush_size) {
+                flush_gif(p_gif);
+            }
+        }
+
+        void end_image(gif_writer *p_gif) {
+            end_lzw(p_gif->p_lzw);
+        }
+
+        /**
+        * Start part of image code stream encoded apart from file, so
+        * parts of one image can be encoded in parallel by own encoders.
+        * Every part starts with empty code table; first one also puts
+        * clear code, as image data does.
+        */
+        void begin_tile(lzw_encoder *p_lzw, lzw_tile *p_tile, bool first) {
+            p_tile->data.clear();
+            p_tile->bits = 0;
+
+            start_lzw_codes(p_lzw, &p_tile->data, true);
+            if (first) {
+                put_lzw_code(p_lzw, lzw_clear_code);
+            }
+        }
+
+        /**
+        * Finish part of code stream: last string, then end code for last
+        * part, or clear code for the next one. Code is put with code size
+        * of this part, as decoder reads it, and its bits are not padded.
+        */
+        void end_tile(lzw_encoder *p_lzw, lzw_tile *p_tile, bool last) {
+            if (p_lzw->prefix >= 0) {
+                put_lzw_code(p_lzw, p_lzw->prefix);
+            }
+            put_lzw_code(p_lzw, last ? lzw_end_code : lzw_clear_code);
+
+            p_tile->bits = p_tile->data.size()*8 + p_lzw->bits_count;
+            if (p_lzw->bits_count > 0) {
+                p_tile->data.push_back(p_lzw->bits & 0xff);
+            }
+
+            p_lzw->out = NULL;
+            p_lzw->raw = false;
+        }
+
+        /**
+        * Write image descriptor and start image data made of parts
+        */
+        void begin_tiled_image(gif_writer *p_gif,
+                               int left, int top, int width, int height) {
+            put_image_descriptor(&p_gif->buffer, left, top, width, height);
+            p_gif->buffer.push_back(lzw_min_code_size);
+
+            start_lzw_codes(p_gif->p_lzw, &p_gif->buffer, false);
+        }
+
+        /**
+        * Append part of code stream to image data at current bit,
+        * parts are passed in image order
+        */
+        void write_tile(gif_writer *p_gif, const lzw_tile &tile) {
+            lzw_encoder *p_lzw = p_gif->p_lzw;
+            size_t full = tile.bits/8, k = 0;
+            int rest = tile.bits % 8;
+
+            for (k = 0; k < full; k++) {
+                p_lzw->bits |= static_cast<unsigned long long>(tile.data[k])
+                               << p_lzw->bits_count;
+                put_lzw_byte(p_lzw, p_lzw->bits & 0xff);
+                p_lzw->bits >>= 8;
+            }
+            if (rest > 0) {
+                p_lzw->bits |= static_cast<unsigned long long>(tile.data[full] & ((1 << rest) - 1)) // NOLINT
+                               << p_lzw->bits_count;
+                p_lzw->bits_count += rest;
+                if (p_lzw->bits_count >= 8) {
+                    put_lzw_byte(p_lzw, p_lzw->bits & 0xff);
+                    p_lzw->bits >>= 8;
+                    p_lzw->bits_count -= 8;
+                }
+            }
+
+            if (p_gif->buffer.size() >= flush_size) {
+                flush_gif(p_gif);
+            }
+        }
+
+        /**
+        * Finish image data of parts: last bits and block terminator
+        */
+        void end_tiled_image(gif_writer *p_gif) {
+            finish_lzw_blocks(p_gif->p_lzw);
+        }
+
+        /**
+        * Write trailer and close file
+        * @return int Zero on success
+        */
+        int close_gif(gif_writer *p_gif) {
+            int result = 0;
+
+            p_gif->buffer.push_back(0x3b);
+            flush_gif(p_gif);
+
+            if (ferror(p_gif->fp)) {
+                result = 1;
+            }
+            if (fclose(p_gif->fp) != 0) {
+                result = 1;
+            }
+
+            delete p_gif->p_lzw;
+            p_gif->p_lzw = NULL;
+
+            return result;
+        }
+    }
+}
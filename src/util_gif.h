@@ -0,0 +1,91 @@
+/*
+Copyright (C) 2009, Oleg Efimov <efimovov@yandex.ru>
+
+See license text in LICENSE file
+*/
+//---------------------------------------------------------------------------
+#ifndef SRC_UTIL_GIF_H_
+#define SRC_UTIL_GIF_H_
+//---------------------------------------------------------------------------
+#include <cstdio>
+#include <vector>
+//---------------------------------------------------------------------------
+#include "./parameters.h"
+//---------------------------------------------------------------------------
+namespace sns {
+    namespace gif {
+        // Code table is hashed by (prefix code, pixel) pairs, 4096 codes
+        // at most, so table is kept below half full
+        const int lzw_table_bits = 13;
+        const int lzw_table_size = 1 << lzw_table_bits;
+
+        /**
+        * LZW encoder for 8-bit palette indexes. Code table is reused
+        * between images and cleared in O(1) by generation counter.
+        */
+        struct lzw_encoder {
+            unsigned int table_keys[lzw_table_size];
+            unsigned short table_codes[lzw_table_size];
+            unsigned int generation;
+
+            int prefix;
+            int next_code;
+            int code_size;
+
+            unsigned long long bits;
+            int bits_count;
+
+            unsigned char block[256];
+            int block_size;
+
+            std::vector<unsigned char> *out;
+            bool raw;  // bytes are put without sub-blocks, see lzw_tile
+        };
+
+        /**
+        * Part of image code stream encoded apart from file: codes are
+        * packed into bytes without sub-blocks, so parts are joined at
+        * any bit into code stream of one image
+        */
+        struct lzw_tile {
+            std::vector<unsigned char> data;
+            size_t bits;
+        };
+
+        void init_lzw(lzw_encoder *p_lzw);
+        void begin_lzw(lzw_encoder *p_lzw, std::vector<unsigned char> *out);
+        void encode_lzw(lzw_encoder *p_lzw,
+                        const unsigned char *indexes, size_t count);
+        void end_lzw(lzw_encoder *p_lzw);
+
+        /**
+        * GIF89a file writer, image data is encoded as rows are passed
+        * and written to file in large blocks
+        */
+        struct gif_writer {
+            FILE *fp;
+            std::vector<unsigned char> buffer;
+            lzw_encoder *p_lzw;
+        };
+
+        int open_gif(gif_writer *p_gif, const char *filename,
+                     int width, int height, const color_palette *p_palette);
+        void write_loop(gif_writer *p_gif);
+        void write_frame_control(gif_writer *p_gif, int delay);
+        void begin_image(gif_writer *p_gif,
+                         int left, int top, int width, int height);
+        void write_pixels(gif_writer *p_gif,
+                          const unsigned char *indexes, size_t count);
+        void end_image(gif_writer *p_gif);
+
+        void begin_tile(lzw_encoder *p_lzw, lzw_tile *p_tile, bool first);
+        void end_tile(lzw_encoder *p_lzw, lzw_tile *p_tile, bool last);
+        void begin_tiled_image(gif_writer *p_gif,
+                               int left, int top, int width, int height);
+        void write_tile(gif_writer *p_gif, const lzw_tile &tile);
+        void end_tiled_image(gif_writer *p_gif);
+        int close_gif(gif_writer *p_gif);
+    }
+}
+//---------------------------------------------------------------------------
+#endif  // SRC_UTIL_GIF_H_
@@ -0,0 +1,451 @@
+/*
+Copyright (C) 2009, Oleg Efimov <efimovov@yandex.ru>
+
+See license text in LICENSE file
+*/
+//---------------------------------------------------------------------------
+#include "./util_reduce.h"
+#include "./util_simd.h"
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+//---------------------------------------------------------------------------
+namespace sns {
+    namespace reduce {
+        /**
+        * Get binary file type by --type name
+        * @return bool False if name is unknown
+        */
+        bool get_file_type(const char *name, binary_file_type *p_type) {
+            if (       strcmp(name, "double") == 0 || strcmp(name, "d") == 0) { // NOLINT
+                *p_type = t_double;
+            } else if (strcmp(name, "complex") == 0 || strcmp(name, "c") == 0) { // NOLINT
+                *p_type = t_complex_double;
+            } else if (strcmp(name, "float") == 0 || strcmp(name, "f") == 0) { // NOLINT
+                *p_type = t_float;
+            } else if (strcmp(name, "cfloat") == 0) {
+                *p_type = t_complex_float;
+            } else if (strcmp(name, "int16") == 0) {
+                *p_type = t_int16;
+            } else if (strcmp(name, "int32") == 0) {
+                *p_type = t_int32;
+            } else {
+                return false;
+            }
+
+            return true;
+        }
+
+        const char* get_file_type_name(binary_file_type file_type) {
+            switch (file_type) {
+                case t_complex_double:
+                    return "std::complex<double>";
+                case t_float:
+                    return "float";
+                case t_complex_float:
+                    return "std::complex<float>";
+                case t_int16:
+                    return "int16";
+                case t_int32:
+                    return "int32";
+                case t_double:
+                default:
+                    return "double";
+            }
+        }
+
+        size_t get_element_size(binary_file_type file_type) {
+            switch (file_type) {
+                case t_complex_double:
+                    return sizeof(std::complex<double>);
+                case t_float:
+                    return sizeof(float);
+                case t_complex_float:
+                    return sizeof(std::complex<float>);
+                case t_int16:
+                    return sizeof(int16_t);
+                case t_int32:
+                    return sizeof(int32_t);
+                case t_double:
+                default:
+                    return sizeof(double);
+            }
+        }
+
+        bool is_complex_type(binary_file_type file_type) {
+            return file_type == t_complex_double ||
+                   file_type == t_complex_float;
+        }
+
+        /**
+        * Get conversion function by --func name, abs by default
+        */
+        reduce_func get_reduce_func(const char *name) {
+            if (       strcmp(name, "norm") == 0) { // NOLINT
+                return f_norm;
+            } else if (strcmp(name, "real") == 0) {
+                return f_real;
+            } else if (strcmp(name, "imag") == 0) {
+                return f_imag;
+            } else if (strcmp(name, "arg") == 0) {
+                return f_arg;
+            }
+
+            return f_abs;
+        }
+
+        /**
+        * Reduce stripe of complex rows: input is converted by SIMD array
+        * kernel in cache-sized chunks, then values are summed in the same
+        * order as in reduce_stripe
+        */
+        template<reduce_func F, bool fast>
+        void reduce_stripe_complex(const void *stripe,
+                                   int bin_width, int to_width,
+                                   int factor_x, int factor_y,
+                                   double *out_row) {
+            static const simd::complex_kernel kernel =
+                simd::get_complex_kernel(F, fast);
+            const int chunk_size = 1024;
+
+            const std::complex<double> *in =
+                static_cast<const std::complex<double>*>(stripe);
+            double values[chunk_size];
+            int chunk_pixels = (factor_x < chunk_size)
+                               ? chunk_size/factor_x : 1;
+
+            int i = 0, i0 = 0, i1 = 0, ii = 0, jj = 0, k = 0;
+
+            for (i = 0; i < to_width; i++) {
+                out_row[i] = 0;
+            }
+
+            for (jj = 0; jj < factor_y; jj++) {
+                const std::complex<double> *in_row =
+                    in + static_cast<off_t>(bin_width)*jj;
+
+                for (i0 = 0; i0 < to_width; i0 = i1) {
+                    i1 = std::min(i0 + chunk_pixels, to_width);
+
+                    if (factor_x <= chunk_size) {
+                        kernel(in_row + factor_x*i0, values,
+                               static_cast<size_t>(factor_x)*(i1 - i0));
+                        for (i = i0, k = 0; i < i1; i++) {
+                            for (ii = 0; ii < factor_x; ii++, k++) {
+                                out_row[i] += values[k];
+                            }
+                        }
+                    } else {
+                        // Very wide blocks, convert one block by parts
+                        for (ii = 0; ii < factor_x; ii += chunk_size) {
+                            int n = std::min(chunk_size, factor_x - ii);
+                            kernel(in_row + factor_x*i0 + ii, values, n);
+                            for (k = 0; k < n; k++) {
+                                out_row[i0] += values[k];
+                            }
+                        }
+                    }
+                }
+            }
+
+            for (i = 0; i < to_width; i++) {
+                out_row[i] = out_row[i]/factor_x/factor_y;
+            }
+        }
+
+        /**
+        * Get reduction kernel for file type and function,
+        * chosen once per file instead of per element.
+        * Cheap real/imag/norm are memory bound and fastest as fused template
+        * loops, abs and arg go through SIMD array kernels.
+        */
+        stripe_reducer get_stripe_reducer(binary_file_type file_type,
+                                          reduce_func func, bool fast_math) {
+            switch (file_type) {
+                case t_double:
+                    return reduce_stripe<double, func_real>;
+                case t_float:
+                    return reduce_stripe<float, func_real>;
+                case t_int16:
+                    return reduce_stripe<int16_t, func_real>;
+                case t_int32:
+                    return reduce_stripe<int32_t, func_real>;
+                case t_complex_float:
+                    // Values are widened to std::complex<double> by fused
+                    // template loops
+                    switch (func) {
+                        case f_real:
+                            return reduce_stripe<std::complex<float>, func_real>; // NOLINT
+                        case f_imag:
+                            return reduce_stripe<std::complex<float>, func_imag>; // NOLINT
+                        case f_norm:
+                            return reduce_stripe<std::complex<float>, func_norm>; // NOLINT
+                        case f_arg:
+                            return reduce_stripe<std::complex<float>, func_arg>; // NOLINT
+                        case f_abs:
+                        default:
+                            return reduce_stripe<std::complex<float>, func_abs>; // NOLINT
+                    }
+                case t_complex_double:
+                default:
+                    break;
+            }
+
+            switch (func) {
+                case f_real:
+                    return reduce_stripe<std::complex<double>, func_real>;
+                case f_imag:
+                    return reduce_stripe<std::complex<double>, func_imag>;
+                case f_norm:
+                    return reduce_stripe<std::complex<double>, func_norm>;
+                case f_arg:
+                    if (fast_math) {
+                        return reduce_stripe_complex<f_arg, true>;
+                    }
+                    return reduce_stripe_complex<f_arg, false>;
+                case f_abs:
+                default:
+                    return reduce_stripe_complex<f_abs, false>;
+            }
+        }
+
+        /**
+        * Get resampling filter by --filter name
+        * @return bool False if name is unknown
+        */
+        bool get_resample_filter(const char *name, resample_filter *p_filter) {
+            if (       strcmp(name, "area") == 0) { // NOLINT
+                *p_filter = rs_area;
+            } else if (strcmp(name, "bilinear") == 0) {
+                *p_filter = rs_bilinear;
+            } else if (strcmp(name, "lanczos3") == 0) {
+                *p_filter = rs_lanczos3;
+            } else if (strcmp(name, "max") == 0) {
+                *p_filter = rs_max;
+            } else if (strcmp(name, "min") == 0) {
+                *p_filter = rs_min;
+            } else {
+                return false;
+            }
+
+            return true;
+        }
+
+        const char* get_resample_filter_name(resample_filter filter) {
+            switch (filter) {
+                case rs_bilinear:
+                    return "bilinear";
+                case rs_lanczos3:
+                    return "lanczos3";
+                case rs_max:
+                    return "max";
+                case rs_min:
+                    return "min";
+                case rs_area:
+                default:
+                    return "area";
+            }
+        }
+
+        /**
+        * Filter kernels, x in input pixels of output scale
+        */
+        double kernel_triangle(double x) {
+            x = fabs(x);
+            return (x < 1.0) ? 1.0 - x : 0.0;
+        }
+
+        double kernel_lanczos3(double x) {
+            if (x == 0.0) {
+                return 1.0;
+            }
+            if (x <= -3.0 || x >= 3.0) {
+                return 0.0;
+            }
+
+            double px = M_PI*x;
+            return 3.0*sin(px)*sin(px/3.0)/(px*px);
+        }
+
+        /**
+        * Get window of input pixels for output pixel i.
+        * Area, max and min take input pixels covered by output pixel,
+        * bilinear and lanczos3 take kernel support around its center,
+        * widened by scale when downsampling.
+        */
+        void get_resample_window(int i, int in_size, int out_size,
+                                 resample_filter filter,
+                                 int *p_lo, int *p_hi) {
+            int64_t lo = 0, hi = 0;
+
+            if (filter == rs_bilinear || filter == rs_lanczos3) {
+                double scale = static_cast<double>(in_size)/out_size;
+                double support = (filter == rs_bilinear) ? 1.0 : 3.0;
+                double center = (i + 0.5)*scale;
+
+                support *= std::max(scale, 1.0);
+                lo = static_cast<int64_t>(floor(center - support));
+                hi = static_cast<int64_t>(ceil(center + support));
+            } else {
+                // Output pixel covers [i*in_size, (i + 1)*in_size)
+                // in units of 1/out_size of input pixel
+                lo = static_cast<int64_t>(i)*in_size/out_size;
+                hi = (static_cast<int64_t>(i + 1)*in_size + out_size - 1)/
+                     out_size;
+            }
+
+            lo = std::max<int64_t>(lo, 0);
+            hi = std::min<int64_t>(hi, in_size);
+            if (hi <= lo) {
+                hi = std::min<int64_t>(lo + 1, in_size);
+                lo = hi - 1;
+            }
+
+            *p_lo = static_cast<int>(lo);
+            *p_hi = static_cast<int>(hi);
+        }
+
+        /**
+        * Precompute resampling weights of axis from in_size to out_size
+        * pixels, once per file. Weights of every output pixel are
+        * normalized, so pixels at borders are not darkened.
+        */
+        void init_resample_axis(int in_size, int out_size,
+                                resample_filter filter, resample_axis *p_axis) {
+            double scale = static_cast<double>(in_size)/out_size;
+            double filter_scale = std::max(scale, 1.0);
+            int i = 0, k = 0, lo = 0, hi = 0;
+
+            p_axis->taps = 1;
+            p_axis->start.resize(out_size);
+            p_axis->count.resize(out_size);
+
+            for (i = 0; i < out_size; i++) {
+                get_resample_window(i, in_size, out_size, filter, &lo, &hi);
+                p_axis->start[i] = lo;
+                p_axis->count[i] = hi - lo;
+                p_axis->taps = std::max(p_axis->taps, hi - lo);
+            }
+
+            p_axis->weights.assign(static_cast<size_t>(out_size)*p_axis->taps,
+                                   0.0);
+            if (filter == rs_max || filter == rs_min) {
+                return;
+            }
+
+            for (i = 0; i < out_size; i++) {
+                double *w = &p_axis->weights[static_cast<size_t>(i)*p_axis->taps]; // NOLINT
+                double center = (i + 0.5)*scale;
+                double sum = 0;
+                int x = 0;
+
+                for (k = 0; k < p_axis->count[i]; k++) {
+                    x = p_axis->start[i] + k;
+
+                    if (filter == rs_area) {
+                        // Overlap of input pixel with output pixel
+                        int64_t a = std::max(static_cast<int64_t>(x)*out_size,
+                                             static_cast<int64_t>(i)*in_size);
+                        int64_t b = std::min(static_cast<int64_t>(x + 1)*out_size, // NOLINT
+                                             static_cast<int64_t>(i + 1)*in_size); // NOLINT
+                        w[k] = static_cast<double>(std::max<int64_t>(b - a, 0)); // NOLINT
+                    } else if (filter == rs_bilinear) {
+                        w[k] = kernel_triangle((x + 0.5 - center)/filter_scale); // NOLINT
+                    } else {
+                        w[k] = kernel_lanczos3((x + 0.5 - center)/filter_scale); // NOLINT
+                    }
+                    sum += w[k];
+                }
+
+                if (sum != 0) {
+                    for (k = 0; k < p_axis->count[i]; k++) {
+                        w[k] /= sum;
+                    }
+                }
+            }
+        }
+
+        /**
+        * Resample row of values horizontally by precomputed axis
+        */
+        void resample_row(const double *in, const resample_axis &axis,
+                          resample_filter filter, double *out) {
+            int out_size = static_cast<int>(axis.start.size());
+            int i = 0, k = 0;
+
+            for (i = 0; i < out_size; i++) {
+                const double *x = in + axis.start[i];
+                const double *w = &axis.weights[static_cast<size_t>(i)*axis.taps]; // NOLINT
+                int n = axis.count[i];
+                double value = x[0];
+
+                if (filter == rs_max) {
+                    for (k = 1; k < n; k++) {
+                        if (x[k] > value) {
+                            value = x[k];
+                        }
+                    }
+                } else if (filter == rs_min) {
+                    for (k = 1; k < n; k++) {
+                        if (x[k] < value) {
+                            value = x[k];
+                        }
+                    }
+                } else {
+                    value = 0;
+                    for (k = 0; k < n; k++) {
+                        value += w[k]*x[k];
+                    }
+                }
+
+                out[i] = value;
+            }
+        }
+
+        /**
+        * Combine count rows of width values into output row by weights
+        * of vertical axis; rows are contiguous, so loops are vectorized
+        */
+        void resample_column(const double * const *rows, const double *weights,
+                             int count, resample_filter filter,
+                             int width, double *out) {
+            int i = 0, k = 0;
+
+            if (filter == rs_max || filter == rs_min) {
+                memcpy(out, rows[0], sizeof(double)*width);
+
+                for (k = 1; k < count; k++) {
+                    const double *row = rows[k];
+
+                    if (filter == rs_max) {
+                        #pragma omp simd
+                        for (i = 0; i < width; i++) {
+                            out[i] = (row[i] > out[i]) ? row[i] : out[i];
+                        }
+                    } else {
+                        #pragma omp simd
+                        for (i = 0; i < width; i++) {
+                            out[i] = (row[i] < out[i]) ? row[i] : out[i];
+                        }
+                    }
+                }
+                return;
+            }
+
+            for (i = 0; i < width; i++) {
+                out[i] = 0;
+            }
+
+            for (k = 0; k < count; k++) {
+                const double *row = rows[k];
+                double w = weights[k];
+
+                #pragma omp simd
+                for (i = 0; i < width; i++) {
+                    out[i] += w*row[i];
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,136 @@
+/*
+Copyright (C) 2009, Oleg Efimov <efimovov@yandex.ru>
+
+See license text in LICENSE file
+*/
+//---------------------------------------------------------------------------
+#ifndef SRC_UTIL_REDUCE_H_
+#define SRC_UTIL_REDUCE_H_
+//---------------------------------------------------------------------------
+#include <stdint.h>
+#include <sys/types.h>
+//---------------------------------------------------------------------------
+#include <complex>
+#include <vector>
+//---------------------------------------------------------------------------
+#include "./parameters.h"
+//---------------------------------------------------------------------------
+namespace sns {
+    namespace reduce {
+        /**
+        * Enumerate for complex to real conversion functions
+        */
+        enum reduce_func {
+            f_real,
+            f_imag,
+            f_abs,
+            f_norm,
+            f_arg
+        };
+
+        /**
+        * Conversion functors, real values are always taken as is,
+        * std::complex<float> values are converted as std::complex<double>
+        */
+        struct func_real {
+            static inline double apply(const std::complex<double> &c) {
+                return c.real();
+            }
+            static inline double apply(double d) {
+                return d;
+            }
+        };
+
+        struct func_imag {
+            static inline double apply(const std::complex<double> &c) {
+                return c.imag();
+            }
+        };
+
+        struct func_abs {
+            static inline double apply(const std::complex<double> &c) {
+                return std::abs(c);
+            }
+        };
+
+        struct func_norm {
+            static inline double apply(const std::complex<double> &c) {
+                return std::norm(c);
+            }
+        };
+
+        struct func_arg {
+            static inline double apply(const std::complex<double> &c) {
+                return std::arg(c);
+            }
+        };
+
+        /**
+        * Reduce stripe of factor_y input rows into one output row,
+        * every output pixel is average of factor_x*factor_y input values
+        */
+        template<typename T, typename F>
+        void reduce_stripe(const void *stripe, int bin_width, int to_width,
+                           int factor_x, int factor_y, double *out_row) {
+            const T *in = static_cast<const T*>(stripe);
+
+            int i = 0, ii = 0, jj = 0;
+            double d_value = 0;
+
+            for (i = 0; i < to_width; i++) {
+                d_value = 0;
+
+                for (jj = 0; jj < factor_y; jj++) {
+                    const T *in_block = in + static_cast<off_t>(bin_width)*jj
+                                           + factor_x*i;
+                    for (ii = 0; ii < factor_x; ii++) {
+                        d_value += F::apply(in_block[ii]);
+                    }
+                }
+
+                out_row[i] = d_value/factor_x/factor_y;
+            }
+        }
+
+        /**
+        * Instantiated stripe reduction kernel
+        */
+        typedef void (*stripe_reducer)(const void *stripe,
+                                       int bin_width, int to_width,
+                                       int factor_x, int factor_y,
+                                       double *out_row);
+
+        /**
+        * Resampling weights of one axis: output pixel i is made of
+        * count[i] input pixels from start[i], weighted by
+        * weights[i*taps + k]
+        */
+        struct resample_axis {
+            int taps;  // maximum count
+            std::vector<int> start;
+            std::vector<int> count;
+            std::vector<double> weights;
+        };
+
+        bool get_file_type(const char *name, binary_file_type *p_type);
+        const char* get_file_type_name(binary_file_type file_type);
+        size_t get_element_size(binary_file_type file_type);
+        bool is_complex_type(binary_file_type file_type);
+
+        reduce_func get_reduce_func(const char *name);
+        stripe_reducer get_stripe_reducer(binary_file_type file_type,
+                                          reduce_func func, bool fast_math);
+
+        bool get_resample_filter(const char *name, resample_filter *p_filter);
+        const char* get_resample_filter_name(resample_filter filter);
+        void init_resample_axis(int in_size, int out_size,
+                                resample_filter filter, resample_axis *p_axis);
+        void resample_row(const double *in, const resample_axis &axis,
+                          resample_filter filter, double *out);
+        void resample_column(const double * const *rows, const double *weights,
+                             int count, resample_filter filter,
+                             int width, double *out);
+    }
+}
+//---------------------------------------------------------------------------
+#endif  // SRC_UTIL_REDUCE_H_
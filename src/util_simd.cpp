@@ -0,0 +1,494 @@
+/*
+Copyright (C) 2009, Oleg Efimov <efimovov@yandex.ru>
+
+See license text in LICENSE file
+*/
+//---------------------------------------------------------------------------
+#include "./util_simd.h"
+//---------------------------------------------------------------------------
+#include <stdint.h>
+//---------------------------------------------------------------------------
+#include <cmath>
+#include <cstring>
+//---------------------------------------------------------------------------
+#if defined(__x86_64__) || defined(__i386__)
+#define BIN2GIF_SIMD_X86
+#include <immintrin.h>
+#endif
+//---------------------------------------------------------------------------
+namespace sns {
+    namespace simd {
+        /**
+        * Squared magnitudes out of this range lose precision,
+        * such values are converted by std::abs
+        */
+        const double norm_min = 9.3326361850321888e-302;  // 2^-1000
+        const double norm_max = 1.0715086071862673e+301;  // 2^1000
+
+        /**
+        * Minimax polynomial for atan(a), a in [0, 1]
+        */
+        const double atan_c0 = 0.99997726;
+        const double atan_c1 = -0.33262347;
+        const double atan_c2 = 0.19354346;
+        const double atan_c3 = -0.11643287;
+        const double atan_c4 = 0.05265332;
+        const double atan_c5 = -0.01172120;
+
+        inline double fast_atan2(double y, double x) {
+            double ax = fabs(x), ay = fabs(y);
+            double mx = (ax > ay) ? ax : ay;
+            double mn = (ax > ay) ? ay : ax;
+            double a = (mx > 0) ? mn/mx : 0;
+            double s = a*a;
+            double r = a*(atan_c0 + s*(atan_c1 + s*(atan_c2 + s*(atan_c3 +
+                       s*(atan_c4 + s*atan_c5)))));
+
+            if (ay > ax) {
+                r = M_PI_2 - r;
+            }
+            if (std::signbit(x)) {
+                r = M_PI - r;
+            }
+
+            return copysign(r, y);
+        }
+
+        inline double guarded_abs(double re, double im) {
+            double n2 = re*re + im*im;
+
+            if (n2 >= norm_min && n2 <= norm_max) {
+                return sqrt(n2);
+            }
+
+            return std::abs(std::complex<double>(re, im));
+        }
+
+        /**
+        * Scalar kernels, also used for array tails
+        */
+        struct scalar_kernels {
+            template<reduce::reduce_func F, bool fast>
+            static inline double apply(double re, double im) {
+                if (F == reduce::f_real) {
+                    return re;
+                } else if (F == reduce::f_imag) {
+                    return im;
+                } else if (F == reduce::f_norm) {
+                    return re*re + im*im;
+                } else if (F == reduce::f_abs) {
+                    return guarded_abs(re, im);
+                } else if (fast) {
+                    return fast_atan2(im, re);
+                }
+
+                return atan2(im, re);
+            }
+
+            template<reduce::reduce_func F, bool fast>
+            static void run(const std::complex<double> *in, double *out,
+                            size_t n) {
+                const double *p = reinterpret_cast<const double*>(in);
+                size_t k = 0;
+
+                for (k = 0; k < n; k++) {
+                    out[k] = apply<F, fast>(p[2*k], p[2*k + 1]);
+                }
+            }
+        };
+
+#ifdef BIN2GIF_SIMD_X86
+        /**
+        * SSE2 kernels, 2 complex values per step
+        */
+        struct sse2_kernels {
+            __attribute__((target("sse2")))
+            static inline __m128d select(__m128d mask, __m128d a, __m128d b) {
+                return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+            }
+
+            __attribute__((target("sse2")))
+            static inline __m128d fast_arg(__m128d re, __m128d im) {
+                const __m128d sign = _mm_set1_pd(-0.0);
+                __m128d ax = _mm_andnot_pd(sign, re);
+                __m128d ay = _mm_andnot_pd(sign, im);
+                __m128d mx = _mm_max_pd(ax, ay);
+                __m128d mn = _mm_min_pd(ax, ay);
+                __m128d a = _mm_and_pd(_mm_div_pd(mn, mx),
+                                       _mm_cmpgt_pd(mx, _mm_setzero_pd()));
+                __m128d s = _mm_mul_pd(a, a);
+                __m128d r = _mm_set1_pd(atan_c5);
+                r = _mm_add_pd(_mm_mul_pd(r, s), _mm_set1_pd(atan_c4));
+                r = _mm_add_pd(_mm_mul_pd(r, s), _mm_set1_pd(atan_c3));
+                r = _mm_add_pd(_mm_mul_pd(r, s), _mm_set1_pd(atan_c2));
+                r = _mm_add_pd(_mm_mul_pd(r, s), _mm_set1_pd(atan_c1));
+                r = _mm_add_pd(_mm_mul_pd(r, s), _mm_set1_pd(atan_c0));
+                r = _mm_mul_pd(r, a);
+
+                r = select(_mm_cmpgt_pd(ay, ax),
+                           _mm_sub_pd(_mm_set1_pd(M_PI_2), r), r);
+
+                // Spread sign bit of re over whole lane
+                __m128i re_sign = _mm_srai_epi32(_mm_castpd_si128(re), 31);
+                re_sign = _mm_shuffle_epi32(re_sign, _MM_SHUFFLE(3, 3, 1, 1));
+                r = select(_mm_castsi128_pd(re_sign),
+                           _mm_sub_pd(_mm_set1_pd(M_PI), r), r);
+
+                return _mm_xor_pd(r, _mm_and_pd(im, sign));
+            }
+
+            template<reduce::reduce_func F, bool fast>
+            __attribute__((target("sse2")))
+            static void run(const std::complex<double> *in, double *out,
+                            size_t n) {
+                const double *p = reinterpret_cast<const double*>(in);
+                size_t k = 0;
+
+                for (k = 0; k + 2 <= n; k += 2) {
+                    __m128d a = _mm_loadu_pd(p + 2*k);
+                    __m128d b = _mm_loadu_pd(p + 2*k + 2);
+                    __m128d re = _mm_unpacklo_pd(a, b);
+                    __m128d im = _mm_unpackhi_pd(a, b);
+                    __m128d r;
+
+                    if (F == reduce::f_real) {
+                        r = re;
+                    } else if (F == reduce::f_imag) {
+                        r = im;
+                    } else if (F == reduce::f_arg) {
+                        r = fast_arg(re, im);
+                    } else {
+                        r = _mm_add_pd(_mm_mul_pd(re, re), _mm_mul_pd(im, im));
+                    }
+
+                    if (F == reduce::f_abs) {
+                        __m128d n2 = r;
+                        int ok = _mm_movemask_pd(_mm_and_pd(
+                                     _mm_cmpge_pd(n2, _mm_set1_pd(norm_min)),
+                                     _mm_cmple_pd(n2, _mm_set1_pd(norm_max))));
+                        _mm_storeu_pd(out + k, _mm_sqrt_pd(n2));
+                        if (ok != 0x3) {
+                            scalar_kernels::run<F, fast>(in + k, out + k, 2);
+                        }
+                    } else {
+                        _mm_storeu_pd(out + k, r);
+                    }
+                }
+
+                scalar_kernels::run<F, fast>(in + k, out + k, n - k);
+            }
+        };
+
+        /**
+        * AVX2 kernels, 4 complex values per step
+        */
+        struct avx2_kernels {
+            __attribute__((target("avx2")))
+            static inline __m256d fast_arg(__m256d re, __m256d im) {
+                const __m256d sign = _mm256_set1_pd(-0.0);
+                __m256d ax = _mm256_andnot_pd(sign, re);
+                __m256d ay = _mm256_andnot_pd(sign, im);
+                __m256d mx = _mm256_max_pd(ax, ay);
+                __m256d mn = _mm256_min_pd(ax, ay);
+                __m256d a = _mm256_and_pd(_mm256_div_pd(mn, mx),
+                                          _mm256_cmp_pd(mx, _mm256_setzero_pd(),
+                                                        _CMP_GT_OQ));
+                __m256d s = _mm256_mul_pd(a, a);
+                __m256d r = _mm256_set1_pd(atan_c5);
+                r = _mm256_add_pd(_mm256_mul_pd(r, s), _mm256_set1_pd(atan_c4));
+                r = _mm256_add_pd(_mm256_mul_pd(r, s), _mm256_set1_pd(atan_c3));
+                r = _mm256_add_pd(_mm256_mul_pd(r, s), _mm256_set1_pd(atan_c2));
+                r = _mm256_add_pd(_mm256_mul_pd(r, s), _mm256_set1_pd(atan_c1));
+                r = _mm256_add_pd(_mm256_mul_pd(r, s), _mm256_set1_pd(atan_c0));
+                r = _mm256_mul_pd(r, a);
+
+                r = _mm256_blendv_pd(r,
+                                     _mm256_sub_pd(_mm256_set1_pd(M_PI_2), r),
+                                     _mm256_cmp_pd(ay, ax, _CMP_GT_OQ));
+                // blendv selects by sign bit of re itself
+                r = _mm256_blendv_pd(r, _mm256_sub_pd(_mm256_set1_pd(M_PI), r),
+                                     re);
+
+                return _mm256_xor_pd(r, _mm256_and_pd(im, sign));
+            }
+
+            template<reduce::reduce_func F, bool fast>
+            __attribute__((target("avx2")))
+            static void run(const std::complex<double> *in, double *out,
+                            size_t n) {
+                const double *p = reinterpret_cast<const double*>(in);
+                size_t k = 0;
+
+                for (k = 0; k + 4 <= n; k += 4) {
+                    __m256d a = _mm256_loadu_pd(p + 2*k);
+                    __m256d b = _mm256_loadu_pd(p + 2*k + 4);
+                    // Lanes come as 0, 2, 1, 3 after unpack, fixed on store
+                    __m256d re = _mm256_unpacklo_pd(a, b);
+                    __m256d im = _mm256_unpackhi_pd(a, b);
+                    __m256d r;
+
+                    if (F == reduce::f_real) {
+                        r = re;
+                    } else if (F == reduce::f_imag) {
+                        r = im;
+                    } else if (F == reduce::f_arg) {
+                        r = fast_arg(re, im);
+                    } else {
+                        r = _mm256_add_pd(_mm256_mul_pd(re, re),
+                                          _mm256_mul_pd(im, im));
+                    }
+
+                    if (F == reduce::f_abs) {
+                        __m256d n2 = r;
+                        int ok = _mm256_movemask_pd(_mm256_and_pd(
+                            _mm256_cmp_pd(n2, _mm256_set1_pd(norm_min),
+                                          _CMP_GE_OQ),
+                            _mm256_cmp_pd(n2, _mm256_set1_pd(norm_max),
+                                          _CMP_LE_OQ)));
+                        r = _mm256_sqrt_pd(n2);
+                        _mm256_storeu_pd(out + k,
+                                         _mm256_permute4x64_pd(r, 0xD8));
+                        if (ok != 0xF) {
+                            scalar_kernels::run<F, fast>(in + k, out + k, 4);
+                        }
+                    } else {
+                        _mm256_storeu_pd(out + k,
+                                         _mm256_permute4x64_pd(r, 0xD8));
+                    }
+                }
+
+                scalar_kernels::run<F, fast>(in + k, out + k, n - k);
+            }
+        };
+
+        /**
+        * AVX-512 kernels, 8 complex values per step
+        */
+        struct avx512_kernels {
+            __attribute__((target("avx512f")))
+            static inline __m512d fast_arg(__m512d re, __m512d im) {
+                const __m512i sign = _mm512_set1_epi64(0x8000000000000000LL);
+                __m512d ax = _mm512_abs_pd(re);
+                __m512d ay = _mm512_abs_pd(im);
+                __mmask8 swap = _mm512_cmp_pd_mask(ay, ax, _CMP_GT_OQ);
+                __m512d mx = _mm512_mask_blend_pd(swap, ax, ay);
+                __m512d mn = _mm512_mask_blend_pd(swap, ay, ax);
+                __m512d a = _mm512_maskz_div_pd(
+                    _mm512_cmp_pd_mask(mx, _mm512_setzero_pd(), _CMP_GT_OQ),
+                    mn, mx);
+                __m512d s = _mm512_mul_pd(a, a);
+                __m512d r = _mm512_set1_pd(atan_c5);
+                r = _mm512_add_pd(_mm512_mul_pd(r, s), _mm512_set1_pd(atan_c4));
+                r = _mm512_add_pd(_mm512_mul_pd(r, s), _mm512_set1_pd(atan_c3));
+                r = _mm512_add_pd(_mm512_mul_pd(r, s), _mm512_set1_pd(atan_c2));
+                r = _mm512_add_pd(_mm512_mul_pd(r, s), _mm512_set1_pd(atan_c1));
+                r = _mm512_add_pd(_mm512_mul_pd(r, s), _mm512_set1_pd(atan_c0));
+                r = _mm512_mul_pd(r, a);
+
+                r = _mm512_mask_sub_pd(r, swap, _mm512_set1_pd(M_PI_2), r);
+                r = _mm512_mask_sub_pd(r,
+                        _mm512_test_epi64_mask(_mm512_castpd_si512(re), sign),
+                        _mm512_set1_pd(M_PI), r);
+
+                return _mm512_castsi512_pd(_mm512_xor_si512(
+                    _mm512_castpd_si512(r),
+                    _mm512_and_si512(_mm512_castpd_si512(im), sign)));
+            }
+
+            template<reduce::reduce_func F, bool fast>
+            __attribute__((target("avx512f")))
+            static void run(const std::complex<double> *in, double *out,
+                            size_t n) {
+                const double *p = reinterpret_cast<const double*>(in);
+                const __m512i re_index = _mm512_set_epi64(14, 12, 10, 8,
+                                                          6, 4, 2, 0);
+                const __m512i im_index = _mm512_set_epi64(15, 13, 11, 9,
+                                                          7, 5, 3, 1);
+                size_t k = 0;
+
+                for (k = 0; k + 8 <= n; k += 8) {
+                    __m512d a = _mm512_loadu_pd(p + 2*k);
+                    __m512d b = _mm512_loadu_pd(p + 2*k + 8);
+                    __m512d re = _mm512_permutex2var_pd(a, re_index, b);
+                    __m512d im = _mm512_permutex2var_pd(a, im_index, b);
+                    __m512d r;
+
+                    if (F == reduce::f_real) {
+                        r = re;
+                    } else if (F == reduce::f_imag) {
+                        r = im;
+                    } else if (F == reduce::f_arg) {
+                        r = fast_arg(re, im);
+                    } else {
+                        r = _mm512_add_pd(_mm512_mul_pd(re, re),
+                                          _mm512_mul_pd(im, im));
+                    }
+
+                    if (F == reduce::f_abs) {
+                        __m512d n2 = r;
+                        __mmask8 ok =
+                            _mm512_cmp_pd_mask(n2, _mm512_set1_pd(norm_min),
+                                               _CMP_GE_OQ) &
+                            _mm512_cmp_pd_mask(n2, _mm512_set1_pd(norm_max),
+                                               _CMP_LE_OQ);
+                        _mm512_storeu_pd(out + k, _mm512_maskz_sqrt_pd(ok, n2));
+                        if (ok != 0xFF) {
+                            scalar_kernels::run<F, fast>(in + k, out + k, 8);
+                        }
+                    } else {
+                        _mm512_storeu_pd(out + k, r);
+                    }
+                }
+
+                scalar_kernels::run<F, fast>(in + k, out + k, n - k);
+            }
+        };
+#endif
+
+        /**
+        * Pick kernel instantiation for function, exact arg is always scalar
+        */
+        template<typename K>
+        complex_kernel select_kernel(reduce::reduce_func func, bool fast_math) {
+            switch (func) {
+                case reduce::f_real:
+                    return K::template run<reduce::f_real, false>;
+                case reduce::f_imag:
+                    return K::template run<reduce::f_imag, false>;
+                case reduce::f_norm:
+                    return K::template run<reduce::f_norm, false>;
+                case reduce::f_arg:
+                    if (fast_math) {
+                        return K::template run<reduce::f_arg, true>;
+                    }
+                    return scalar_kernels::run<reduce::f_arg, false>;
+                case reduce::f_abs:
+                default:
+                    return K::template run<reduce::f_abs, false>;
+            }
+        }
+
+        simd_level detect_simd_level() {
+#ifdef BIN2GIF_SIMD_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) {
+                return simd_avx512;
+            } else if (__builtin_cpu_supports("avx2")) {
+                return simd_avx2;
+            } else if (__builtin_cpu_supports("sse2")) {
+                return simd_sse2;
+            }
+#endif
+            return simd_scalar;
+        }
+
+        simd_level get_simd_level() {
+            static const simd_level level = detect_simd_level();
+            return level;
+        }
+
+        const char* get_simd_name(simd_level level) {
+            switch (level) {
+                case simd_avx512:
+                    return "AVX-512";
+                case simd_avx2:
+                    return "AVX2";
+                case simd_sse2:
+                    return "SSE2";
+                case simd_scalar:
+                default:
+                    return "scalar";
+            }
+        }
+
+        complex_kernel get_complex_kernel(reduce::reduce_func func,
+                                          bool fast_math, simd_level level) {
+            if (level > get_simd_level()) {
+                level = get_simd_level();
+            }
+
+            switch (level) {
+#ifdef BIN2GIF_SIMD_X86
+                case simd_avx512:
+                    return select_kernel<avx512_kernels>(func, fast_math);
+                case simd_avx2:
+                    return select_kernel<avx2_kernels>(func, fast_math);
+                case simd_sse2:
+                    return select_kernel<sse2_kernels>(func, fast_math);
+#endif
+                default:
+                    return select_kernel<scalar_kernels>(func, fast_math);
+            }
+        }
+
+        complex_kernel get_complex_kernel(reduce::reduce_func func,
+                                          bool fast_math) {
+            return get_complex_kernel(func, fast_math, get_simd_level());
+        }
+
+        void byteswap_scalar(unsigned char *p, size_t count, size_t size) {
+            size_t k = 0;
+
+            for (k = 0; k < count; k++, p += size) {
+                if (size == 2) {
+                    uint16_t v;
+                    memcpy(&v, p, 2);
+                    v = __builtin_bswap16(v);
+                    memcpy(p, &v, 2);
+                } else if (size == 4) {
+                    uint32_t v;
+                    memcpy(&v, p, 4);
+                    v = __builtin_bswap32(v);
+                    memcpy(p, &v, 4);
+                } else if (size == 8) {
+                    uint64_t v;
+                    memcpy(&v, p, 8);
+                    v = __builtin_bswap64(v);
+                    memcpy(p, &v, 8);
+                }
+            }
+        }
+
+#ifdef BIN2GIF_SIMD_X86
+        /**
+        * AVX2 byte shuffle, 32 bytes per step; shuffle works inside
+        * 16-byte lanes, which hold whole values of any size
+        */
+        __attribute__((target("avx2")))
+        void byteswap_avx2(unsigned char *p, size_t count, size_t size) {
+            char order[32];
+            size_t bytes = count*size, k = 0;
+
+            for (k = 0; k < 32; k++) {
+                size_t byte = k % 16;
+                order[k] = byte - byte % size + size - 1 - byte % size;
+            }
+
+            __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(order)); // NOLINT
+
+            for (k = 0; k + 32 <= bytes; k += 32) {
+                __m256i *v = reinterpret_cast<__m256i*>(p + k);
+                _mm256_storeu_si256(v, _mm256_shuffle_epi8(_mm256_loadu_si256(v),
+                                                           mask));
+            }
+
+            byteswap_scalar(p + k, (bytes - k)/size, size);
+        }
+#endif
+
+        /**
+        * Reverse byte order of count values of 2, 4 or 8 bytes in place
+        */
+        void byteswap(void *data, size_t count, size_t size) {
+            unsigned char *p = static_cast<unsigned char*>(data);
+
+#ifdef BIN2GIF_SIMD_X86
+            if (get_simd_level() >= simd_avx2) {
+                byteswap_avx2(p, count, size);
+                return;
+            }
+#endif
+            byteswap_scalar(p, count, size);
+        }
+    }
+}
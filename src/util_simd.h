@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2009, Oleg Efimov <efimovov@yandex.ru>
+
+See license text in LICENSE file
+*/
+//---------------------------------------------------------------------------
+#ifndef SRC_UTIL_SIMD_H_
+#define SRC_UTIL_SIMD_H_
+//---------------------------------------------------------------------------
+#include <cstddef>
+#include <complex>
+//---------------------------------------------------------------------------
+#include "./util_reduce.h"
+//---------------------------------------------------------------------------
+namespace sns {
+    namespace simd {
+        /**
+        * Array kernel, converts n interleaved std::complex<double> values
+        * into n doubles.
+        *
+        * Kernels compute norm as re*re + im*im and abs as its square root,
+        * which is within 1 ulp of std::norm/std::abs; values whose squares
+        * would overflow or underflow (and NaN/Inf) are passed to std::abs.
+        * Exact arg uses libm atan2. Fast arg (--fast-math) uses polynomial
+        * atan approximation with absolute error below 2e-6 rad, that is
+        * about 1e-4 of one color step for [-pi, pi] range.
+        */
+        typedef void (*complex_kernel)(const std::complex<double> *in,
+                                       double *out, size_t n);
+
+        /**
+        * Enumerate for instruction sets, detected at runtime
+        */
+        enum simd_level {
+            simd_scalar,
+            simd_sse2,
+            simd_avx2,
+            simd_avx512
+        };
+
+        simd_level get_simd_level();
+        const char* get_simd_name(simd_level level);
+
+        complex_kernel get_complex_kernel(reduce::reduce_func func,
+                                          bool fast_math);
+        complex_kernel get_complex_kernel(reduce::reduce_func func,
+                                          bool fast_math, simd_level level);
+
+        void byteswap(void *data, size_t count, size_t size);
+    }
+}
+//---------------------------------------------------------------------------
+#endif  // SRC_UTIL_SIMD_H_
@@ -0,0 +1,612 @@
+/*
+Copyright (C) 2009, Oleg Efimov <efimovov@yandex.ru>
+
+See license text in LICENSE file
+*/
+//---------------------------------------------------------------------------
+#include "./util_stats.h"
+#include "./util_fs.h"
+#include "./util_reduce.h"
+//---------------------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+//---------------------------------------------------------------------------
+namespace sns {
+    namespace stats {
+        // Index and manifest are kept in directory of data files
+        const char *index_name = ".bin2gif_index";
+        const char *index_header = "# bin2gif index 1";
+        const char *manifest_name = ".bin2gif_manifest";
+        const char *manifest_header = "# bin2gif manifest 1";
+
+        /**
+        * Parameters that change reduced values of file
+        * @param with_range Add --range, which changes only data range
+        */
+        std::string get_key(const bin2gif_parameters *p_params,
+                            bool with_range) {
+            char key[256];
+
+            snprintf(key, sizeof(key),
+                     "func=%s,type=%s,size=%dx%d,resize=%dx%d,header=%d,footer=%d,axial=%d%d,fast=%d", // NOLINT
+                     p_params->to_func,
+                     (p_params->bin_type >= 0)
+                         ? reduce::get_file_type_name(static_cast<binary_file_type>(p_params->bin_type)) // NOLINT
+                         : "auto",
+                     p_params->bin_width, p_params->bin_height,
+                     p_params->to_width, p_params->to_height,
+                     p_params->bin_header, p_params->bin_footer,
+                     p_params->bin_axial, p_params->bin_axial_all,
+                     p_params->fast_math);
+
+            // Options off by default are added only when used,
+            // so keys of old indexes stay valid
+            if (p_params->bin_axial && p_params->layer_first >= 0) {
+                if (p_params->layer_last > p_params->layer_first) {
+                    // Range of --global-range is found over all layers
+                    snprintf(key + strlen(key), sizeof(key) - strlen(key),
+                             ",layers=%d:%d:%d", p_params->layer_first,
+                             p_params->layer_last, p_params->layer_step);
+                } else {
+                    snprintf(key + strlen(key), sizeof(key) - strlen(key),
+                             ",layer=%d", p_params->layer_first);
+                }
+            }
+
+            if (p_params->crop_width > 0) {
+                snprintf(key + strlen(key), sizeof(key) - strlen(key),
+                         ",crop=%dx%d+%d+%d",
+                         p_params->crop_width, p_params->crop_height,
+                         p_params->crop_x, p_params->crop_y);
+            }
+            if (p_params->byteswap) {
+                snprintf(key + strlen(key), sizeof(key) - strlen(key),
+                         ",byteswap=1");
+            }
+            if (p_params->preview_stride > 1) {
+                snprintf(key + strlen(key), sizeof(key) - strlen(key),
+                         ",preview=%d", p_params->preview_stride);
+            }
+            if (p_params->use_range && with_range) {
+                snprintf(key + strlen(key), sizeof(key) - strlen(key),
+                         ",range=p%g:p%g",
+                         p_params->range_low, p_params->range_high);
+            }
+            if (p_params->to_filter != rs_area) {
+                snprintf(key + strlen(key), sizeof(key) - strlen(key),
+                         ",filter=%s",
+                         reduce::get_resample_filter_name(p_params->to_filter)); // NOLINT
+            }
+
+            return std::string(key);
+        }
+
+        /**
+        * Parameters that change reduced values of file or its data range,
+        * stats found with other parameters are not reused
+        */
+        std::string get_stats_key(const bin2gif_parameters *p_params) {
+            return get_key(p_params, true);
+        }
+
+        /**
+        * File with given name in directory of another file
+        */
+        std::string get_sibling_filename(const std::string &filename,
+                                         const char *name) {
+            size_t slash = filename.rfind('/');
+
+            if (slash == std::string::npos) {
+                return std::string(name);
+            }
+
+            return filename.substr(0, slash + 1) + name;
+        }
+
+        std::string get_base_name(const std::string &filename) {
+            size_t slash = filename.rfind('/');
+
+            if (slash == std::string::npos) {
+                return filename;
+            }
+
+            return filename.substr(slash + 1);
+        }
+
+        std::string get_index_filename(const std::string &filename_bin) {
+            return get_sibling_filename(filename_bin, index_name);
+        }
+
+        /**
+        * Read index, missing index is empty
+        * @return int 0 on success, 1 if index is damaged
+        */
+        int load_index(const char *filename_index,
+                       std::vector<file_stats> *entries) {
+            char line[4096];
+            FILE *fp = fopen(filename_index, "r");
+
+            entries->clear();
+
+            if (!fp) {
+                return 0;
+            }
+
+            if (!fgets(line, sizeof(line), fp) ||
+                strncmp(line, index_header, strlen(index_header)) != 0) {
+                fclose(fp);
+                return 1;
+            }
+
+            // name <tab> size <tab> mtime <tab> key <tab> min <tab> max
+            while (fgets(line, sizeof(line), fp)) {
+                char *fields[6];
+                char *p = line;
+                int n = 0;
+
+                line[strcspn(line, "\n")] = '\0';
+
+                for (n = 0; n < 6 && p; n++) {
+                    fields[n] = p;
+                    p = strchr(p, '\t');
+                    if (p) {
+                        *p++ = '\0';
+                    }
+                }
+
+                if (n < 6) {
+                    continue;
+                }
+
+                file_stats entry;
+                entry.name = fields[0];
+                entry.size = strtoll(fields[1], NULL, 10);
+                entry.mtime = strtoll(fields[2], NULL, 10);
+                entry.key = fields[3];
+                entry.min = strtod(fields[4], NULL);
+                entry.max = strtod(fields[5], NULL);
+
+                entries->push_back(entry);
+            }
+
+            fclose(fp);
+
+            return 0;
+        }
+
+        /**
+        * Write index to temporary file and move it over old one,
+        * so readers never see half-written index
+        * @return int 0 on success
+        */
+        int save_index(const char *filename_index,
+                       const std::vector<file_stats> &entries) {
+            std::string filename_tmp = std::string(filename_index) + ".tmp";
+            FILE *fp = fopen(filename_tmp.c_str(), "w");
+            size_t i = 0;
+
+            if (!fp) {
+                return 1;
+            }
+
+            fprintf(fp, "%s\n", index_header);
+            for (i = 0; i < entries.size(); i++) {
+                fprintf(fp, "%s\t%lld\t%lld\t%s\t%.17g\t%.17g\n",
+                        entries[i].name.c_str(),
+                        static_cast<long long>(entries[i].size),
+                        static_cast<long long>(entries[i].mtime),
+                        entries[i].key.c_str(),
+                        entries[i].min, entries[i].max);
+            }
+
+            if (fclose(fp) != 0 ||
+                rename(filename_tmp.c_str(), filename_index) != 0) {
+                remove(filename_tmp.c_str());
+                return 1;
+            }
+
+            return 0;
+        }
+
+        /**
+        * Find stats of unchanged file
+        * @param current File name, size, mtime and key to match
+        * @return file_stats* Entry or NULL if file must be scanned
+        */
+        const file_stats* find_stats(const std::vector<file_stats> &entries,
+                                     const file_stats &current) {
+            size_t i = 0;
+
+            for (i = 0; i < entries.size(); i++) {
+                if (entries[i].name == current.name &&
+                    entries[i].size == current.size &&
+                    entries[i].mtime == current.mtime &&
+                    entries[i].key == current.key) {
+                    return &entries[i];
+                }
+            }
+
+            return NULL;
+        }
+
+        /**
+        * Replace stats of file with same name and key, or add new
+        */
+        void update_stats(std::vector<file_stats> *entries,
+                          const file_stats &current) {
+            size_t i = 0;
+
+            for (i = 0; i < entries->size(); i++) {
+                if ((*entries)[i].name == current.name &&
+                    (*entries)[i].key == current.key) {
+                    (*entries)[i] = current;
+                    return;
+                }
+            }
+
+            entries->push_back(current);
+        }
+
+        /**
+        * Digest of all parameters that change produced image; --gif-tiles
+        * changes only encoding of the same pixels
+        */
+        unsigned long long get_params_digest(const bin2gif_parameters *p_params) { // NOLINT
+            const unsigned long long prime = 0x100000001b3ULL;
+            unsigned long long h = 0xcbf29ce484222325ULL;
+            char text[512];
+            size_t i = 0, n = 0;
+
+            snprintf(text, sizeof(text),
+                     "%s,reflect=%d,mathgl=%d,amp=%.17g,e=%d,min=%d:%.17g,max=%d:%.17g,global=%d:%.17g:%.17g", // NOLINT
+                     get_stats_key(p_params).c_str(),
+                     p_params->to_reflect, p_params->use_mathgl,
+                     p_params->to_amp, p_params->to_amp_e,
+                     p_params->to_use_min,
+                     p_params->to_use_min ? p_params->to_min : 0,
+                     p_params->to_use_max,
+                     p_params->to_use_max ? p_params->to_max : 0,
+                     p_params->global_range,
+                     p_params->global_range ? p_params->global_min : 0,
+                     p_params->global_range ? p_params->global_max : 0);
+
+            // Options off by default are added only when used
+            if (p_params->to_scale != cs_linear) {
+                snprintf(text + strlen(text), sizeof(text) - strlen(text),
+                         ",scale=%d:%.17g",
+                         p_params->to_scale, p_params->to_linthresh);
+            }
+
+            // FNV-1a over parameters text and palette colors
+            n = strlen(text);
+            for (i = 0; i < n; i++) {
+                h = (h ^ static_cast<unsigned char>(text[i]))*prime;
+            }
+            for (i = 0; i < 256; i++) {
+                h = (h ^ p_params->palette.colors[i][0])*prime;
+                h = (h ^ p_params->palette.colors[i][1])*prime;
+                h = (h ^ p_params->palette.colors[i][2])*prime;
+            }
+
+            return h;
+        }
+
+        /**
+        * Current state of input file, contents are hashed with --hash.
+        * Found once per file, digest of parameters is set per function.
+        */
+        void get_input_record(char* filename_bin,
+                              const bin2gif_parameters *p_params,
+                              output_record *p_record) {
+            p_record->input = get_base_name(filename_bin);
+            p_record->size = fs::file_size(filename_bin);
+            p_record->mtime = fs::file_mtime(filename_bin);
+            p_record->hash = p_params->hash_inputs
+                             ? fs::file_hash(filename_bin) : 0;
+            p_record->params = 0;
+        }
+
+        /**
+        * Read manifest, missing or damaged manifest is empty
+        */
+        void load_manifest(const std::string &filename_manifest,
+                           std::map<std::string, output_record> *records) {
+            char line[4096];
+            FILE *fp = fopen(filename_manifest.c_str(), "r");
+
+            records->clear();
+
+            if (!fp) {
+                return;
+            }
+
+            if (!fgets(line, sizeof(line), fp) ||
+                strncmp(line, manifest_header, strlen(manifest_header)) != 0) { // NOLINT
+                fclose(fp);
+                return;
+            }
+
+            // output <tab> input <tab> size <tab> mtime <tab> hash <tab> params
+            while (fgets(line, sizeof(line), fp)) {
+                char *fields[6];
+                char *p = line;
+                int n = 0;
+
+                line[strcspn(line, "\n")] = '\0';
+
+                for (n = 0; n < 6 && p; n++) {
+                    fields[n] = p;
+                    p = strchr(p, '\t');
+                    if (p) {
+                        *p++ = '\0';
+                    }
+                }
+
+                if (n < 6) {
+                    continue;
+                }
+
+                output_record record;
+                record.input = fields[1];
+                record.size = strtoll(fields[2], NULL, 10);
+                record.mtime = strtoll(fields[3], NULL, 10);
+                record.hash = strtoull(fields[4], NULL, 16);
+                record.params = strtoull(fields[5], NULL, 16);
+
+                (*records)[fields[0]] = record;
+            }
+
+            fclose(fp);
+        }
+
+        std::map<std::string, output_record>* get_manifest_records(
+                manifest *p_manifest, const std::string &filename_image) {
+            std::string filename_manifest =
+                get_sibling_filename(filename_image, manifest_name);
+
+            if (p_manifest->files.find(filename_manifest) ==
+                p_manifest->files.end()) {
+                load_manifest(filename_manifest,
+                              &p_manifest->files[filename_manifest]);
+            }
+
+            return &p_manifest->files[filename_manifest];
+        }
+
+        /**
+        * Check that output exists and was made from the same input state
+        * with the same parameters. Outputs without record are not trusted.
+        */
+        bool is_output_current(manifest *p_manifest, char* filename_image,
+                               const output_record &current) {
+            if (!fs::file_exists(filename_image)) {
+                return false;
+            }
+
+            std::map<std::string, output_record> *records =
+                get_manifest_records(p_manifest, filename_image);
+            std::map<std::string, output_record>::const_iterator it =
+                records->find(get_base_name(filename_image));
+
+            if (it == records->end()) {
+                return false;
+            }
+
+            const output_record &known = it->second;
+            return known.input == current.input &&
+                   known.size == current.size &&
+                   known.mtime == current.mtime &&
+                   (current.hash == 0 || known.hash == current.hash) &&
+                   known.params == current.params;
+        }
+
+        void put_manifest_record(FILE *fp, const std::string &name,
+                                 const output_record &record) {
+            fprintf(fp, "%s\t%s\t%lld\t%lld\t%016llx\t%016llx\n",
+                    name.c_str(), record.input.c_str(),
+                    static_cast<long long>(record.size),
+                    static_cast<long long>(record.mtime),
+                    record.hash, record.params);
+        }
+
+        /**
+        * Remember output and append its record to manifest at once, so
+        * outputs made before batch is killed are not made again. Later
+        * record of output replaces earlier one as manifest is read.
+        * @return int 0 on success
+        */
+        int record_output(manifest *p_manifest, char* filename_image,
+                          const output_record &current) {
+            std::string filename_manifest =
+                get_sibling_filename(filename_image, manifest_name);
+            std::string name = get_base_name(filename_image);
+            bool exists = fs::file_exists(const_cast<char*>(filename_manifest.c_str())); // NOLINT
+
+            (*get_manifest_records(p_manifest, filename_image))[name] =
+                current;
+            p_manifest->changed.insert(filename_manifest);
+
+            FILE *fp = fopen(filename_manifest.c_str(), "a");
+            if (!fp) {
+                return 1;
+            }
+
+            if (!exists) {
+                fprintf(fp, "%s\n", manifest_header);
+            }
+            put_manifest_record(fp, name, current);
+
+            return (fclose(fp) != 0) ? 1 : 0;
+        }
+
+        /**
+        * Write changed manifests without repeated records, through
+        * temporary files as index
+        * @return int 0 on success
+        */
+        int save_manifests(manifest *p_manifest) {
+            std::set<std::string>::const_iterator it;
+            int result = 0;
+
+            for (it = p_manifest->changed.begin();
+                 it != p_manifest->changed.end(); ++it) {
+                const std::map<std::string, output_record> &records =
+                    p_manifest->files[*it];
+                std::map<std::string, output_record>::const_iterator r;
+                std::string filename_tmp = *it + ".tmp";
+
+                FILE *fp = fopen(filename_tmp.c_str(), "w");
+                if (!fp) {
+                    result = 1;
+                    continue;
+                }
+
+                fprintf(fp, "%s\n", manifest_header);
+                for (r = records.begin(); r != records.end(); ++r) {
+                    put_manifest_record(fp, r->first, r->second);
+                }
+
+                if (fclose(fp) != 0 ||
+                    rename(filename_tmp.c_str(), it->c_str()) != 0) {
+                    remove(filename_tmp.c_str());
+                    result = 1;
+                }
+            }
+
+            p_manifest->changed.clear();
+
+            return result;
+        }
+
+        /**
+        * Reduced data cache is kept next to input file, one per function
+        * and --axial time layer
+        */
+        std::string get_cache_filename(char* filename_bin,
+                                       const bin2gif_job *p_job) {
+            std::string name = "." + get_base_name(filename_bin) + "_" +
+                               p_job->p_params->to_func;
+
+            if (p_job->p_params->bin_axial && p_job->layer >= 0) {
+                char layer[32];
+                snprintf(layer, sizeof(layer), "_layer%d", p_job->layer);
+                name += layer;
+            }
+            name += ".cache";
+
+            return get_sibling_filename(filename_bin, name.c_str());
+        }
+
+        /**
+        * Header of reduced data cache, followed by width*height doubles.
+        * Range is exact one, --range is found from cached data.
+        */
+        struct cache_header {
+            char magic[8];
+            long long size;    // input file state
+            long long mtime;
+            char key[256];     // reduction parameters
+            int width;
+            int height;
+            double sr;
+            double st;
+            double min;
+            double max;
+        };
+
+        const char cache_magic[8] = {'B', '2', 'G', 'C', 'A', 'C', 'H', '1'};
+
+        /**
+        * Load reduced data of file if cache was made from the same input
+        * state with the same reduction parameters; input is not opened
+        * @return double* Reduced data, NULL if there is no valid cache
+        */
+        double* load_cache(char* filename_bin, bin2gif_job *p_job,
+                           double *p_min, double *p_max) {
+            std::string filename_cache = get_cache_filename(filename_bin,
+                                                            p_job);
+            std::string key = get_key(p_job->p_params, false);
+            cache_header header;
+
+            FILE *fp = fopen(filename_cache.c_str(), "rb");
+            if (!fp) {
+                return NULL;
+            }
+
+            if (fread(&header, sizeof(header), 1, fp) != 1 ||
+                memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+                header.size != fs::file_size(filename_bin) ||
+                header.mtime != fs::file_mtime(filename_bin) ||
+                strncmp(header.key, key.c_str(), sizeof(header.key)) != 0 ||
+                header.width <= 0 || header.height <= 0) {
+                fclose(fp);
+                return NULL;
+            }
+
+            size_t count = static_cast<size_t>(header.width)*header.height;
+            double *ddata = new double[count];
+
+            if (fread(ddata, sizeof(double), count, fp) != count) {
+                delete[] ddata;
+                fclose(fp);
+                return NULL;
+            }
+
+            fclose(fp);
+
+            p_job->to_width = header.width;
+            p_job->to_height = header.height;
+            p_job->sr = header.sr;
+            p_job->st = header.st;
+
+            *p_min = header.min;
+            *p_max = header.max;
+
+            return ddata;
+        }
+
+        /**
+        * Save reduced data of file, through temporary file
+        * @return int 0 on success
+        */
+        int save_cache(char* filename_bin, const bin2gif_job *p_job,
+                       const double *ddata, double d_min, double d_max) {
+            std::string filename_cache = get_cache_filename(filename_bin,
+                                                            p_job);
+            std::string filename_tmp = filename_cache + ".tmp";
+            std::string key = get_key(p_job->p_params, false);
+            size_t count = static_cast<size_t>(p_job->to_width)*
+                           p_job->to_height;
+            cache_header header;
+
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, cache_magic, sizeof(cache_magic));
+            header.size = fs::file_size(filename_bin);
+            header.mtime = fs::file_mtime(filename_bin);
+            snprintf(header.key, sizeof(header.key), "%s", key.c_str());
+            header.width = p_job->to_width;
+            header.height = p_job->to_height;
+            header.sr = p_job->sr;
+            header.st = p_job->st;
+            header.min = d_min;
+            header.max = d_max;
+
+            FILE *fp = fopen(filename_tmp.c_str(), "wb");
+            if (!fp) {
+                return 1;
+            }
+
+            bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                           fwrite(ddata, sizeof(double), count, fp) == count;
+
+            if (fclose(fp) != 0 || !written ||
+                rename(filename_tmp.c_str(), filename_cache.c_str()) != 0) {
+                remove(filename_tmp.c_str());
+                return 1;
+            }
+
+            return 0;
+        }
+    }
+}
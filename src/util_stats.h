@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2009, Oleg Efimov <efimovov@yandex.ru>
+
+See license text in LICENSE file
+*/
+//---------------------------------------------------------------------------
+#ifndef SRC_UTIL_STATS_H_
+#define SRC_UTIL_STATS_H_
+//---------------------------------------------------------------------------
+#include <sys/types.h>
+#include <time.h>
+//---------------------------------------------------------------------------
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+//---------------------------------------------------------------------------
+#include "./parameters.h"
+//---------------------------------------------------------------------------
+namespace sns {
+    namespace stats {
+        /**
+        * Data range of one file, valid while file size and mtime
+        * and reduction parameters are the same
+        */
+        struct file_stats {
+            std::string name;  // file name without directory
+            off_t size;
+            time_t mtime;
+            std::string key;   // reduction parameters, see get_stats_key
+            double min;
+            double max;
+        };
+
+        std::string get_stats_key(const bin2gif_parameters *p_params);
+        std::string get_index_filename(const std::string &filename_bin);
+
+        int load_index(const char *filename_index,
+                       std::vector<file_stats> *entries);
+        int save_index(const char *filename_index,
+                       const std::vector<file_stats> &entries);
+
+        const file_stats* find_stats(const std::vector<file_stats> &entries,
+                                     const file_stats &current);
+        void update_stats(std::vector<file_stats> *entries,
+                          const file_stats &current);
+
+        /**
+        * State of input file and rendering parameters output was made from
+        */
+        struct output_record {
+            std::string input;          // input file name without directory
+            off_t size;
+            time_t mtime;
+            unsigned long long hash;    // input contents, 0 if not hashed
+            unsigned long long params;  // digest of rendering parameters
+        };
+
+        /**
+        * Output records by manifest filename and output name,
+        * manifests are loaded for directories as outputs are checked
+        * and records are appended to them as outputs are made
+        */
+        struct manifest {
+            std::map<std::string,
+                     std::map<std::string, output_record> > files;
+            std::set<std::string> changed;
+        };
+
+        unsigned long long get_params_digest(const bin2gif_parameters *p_params); // NOLINT
+        void get_input_record(char* filename_bin,
+                              const bin2gif_parameters *p_params,
+                              output_record *p_record);
+        bool is_output_current(manifest *p_manifest, char* filename_image,
+                               const output_record &current);
+        int record_output(manifest *p_manifest, char* filename_image,
+                          const output_record &current);
+        int save_manifests(manifest *p_manifest);
+
+        double* load_cache(char* filename_bin, bin2gif_job *p_job,
+                           double *p_min, double *p_max);
+        int save_cache(char* filename_bin, const bin2gif_job *p_job,
+                       const double *ddata, double d_min, double d_max);
+    }
+}
+//---------------------------------------------------------------------------
+#endif  // SRC_UTIL_STATS_H_
@@ -6,291 +6,883 @@ See license text in LICENSE file
 //---------------------------------------------------------------------------
 #include "./util_visualize.h"
 #include "./util_fs.h"
+#include "./util_reduce.h"
+#include "./util_simd.h"
+#include "./util_gif.h"
+#include "./util_stats.h"
+//---------------------------------------------------------------------------
+#include <fcntl.h>
+#include <unistd.h>
 //---------------------------------------------------------------------------
 namespace sns {
     namespace visual {
         /**
-        * Returns real part of std::complex number
-        * @param std::complex<double> std::complex number
-        * @return double Real part
+        * Struct for palette point, readed from file
         */
-        double real(const std::complex<double> &c) {
-            return c.real();
-        }
+        struct palette_point {
+            int i;  // point index
+
+            int r;  // red channel
+            int g;  // green channel
+            int b;  // blue channel
+        };
 
         /**
-        * Returns imagine part of std::complex number
-        * @param std::complex<double> std::complex number
-        * @return double Imagine part
+        * Comparison function for palette points
         */
-        double imag(const std::complex<double> &c) {
-            return c.imag();
+        bool compare_palette_points(palette_point a, palette_point b) {
+            if (a.i < b.i) {
+                return true;
+            } else {
+                return false;
+            }
         }
 
         /**
-        * Interpolate value by one coordinate
+        * Built-in palettes: files in palettes/ and perceptually uniform
+        * maps of matplotlib, by 10 colors at equal steps
         */
-        template<typename T>
-        T interpolate1D(double r1, double r2, T I1, T I2, double r) {
-            return (I1*(r2-r) + I2*(r-r1))/(r2-r1);
+        const palette_point palette_rainbow[] = {
+            {1, 139, 0, 255}, {2, 0, 0, 255}, {3, 66, 170, 255},
+            {4, 0, 255, 0}, {5, 255, 255, 0}, {6, 255, 165, 0},
+            {7, 255, 0, 0}
+        };
+        const palette_point palette_blue_red[] = {
+            {0, 0, 0, 255}, {255, 255, 0, 0}
+        };
+        const palette_point palette_black_white[] = {
+            {0, 0, 0, 0}, {255, 255, 255, 255}
+        };
+        const palette_point palette_white_black[] = {
+            {0, 255, 255, 255}, {255, 0, 0, 0}
+        };
+        const palette_point palette_viridis[] = {
+            {0, 0x44, 0x01, 0x54}, {1, 0x48, 0x28, 0x78}, {2, 0x3e, 0x4a, 0x89},
+            {3, 0x31, 0x68, 0x8e}, {4, 0x26, 0x82, 0x8e}, {5, 0x1f, 0x9e, 0x89},
+            {6, 0x35, 0xb7, 0x79}, {7, 0x6d, 0xcd, 0x59}, {8, 0xb4, 0xde, 0x2c},
+            {9, 0xfd, 0xe7, 0x25}
+        };
+        const palette_point palette_magma[] = {
+            {0, 0x00, 0x00, 0x04}, {1, 0x18, 0x0f, 0x3e}, {2, 0x45, 0x10, 0x77},
+            {3, 0x72, 0x1f, 0x81}, {4, 0x9f, 0x2f, 0x7f}, {5, 0xcd, 0x40, 0x71},
+            {6, 0xf1, 0x60, 0x5d}, {7, 0xfd, 0x95, 0x67}, {8, 0xfe, 0xc9, 0x8d},
+            {9, 0xfc, 0xfd, 0xbf}
+        };
+        const palette_point palette_inferno[] = {
+            {0, 0x00, 0x00, 0x04}, {1, 0x1b, 0x0c, 0x42}, {2, 0x4b, 0x0c, 0x6b},
+            {3, 0x78, 0x1c, 0x6d}, {4, 0xa5, 0x2c, 0x60}, {5, 0xcf, 0x44, 0x46},
+            {6, 0xed, 0x69, 0x25}, {7, 0xfb, 0x9a, 0x06}, {8, 0xf7, 0xd0, 0x3c},
+            {9, 0xfc, 0xff, 0xa4}
+        };
+        const palette_point palette_plasma[] = {
+            {0, 0x0d, 0x08, 0x87}, {1, 0x47, 0x03, 0x9f}, {2, 0x73, 0x01, 0xa8},
+            {3, 0x9c, 0x17, 0x9e}, {4, 0xbd, 0x37, 0x86}, {5, 0xd8, 0x57, 0x6b},
+            {6, 0xed, 0x79, 0x53}, {7, 0xfa, 0x9e, 0x3b}, {8, 0xfd, 0xc9, 0x26},
+            {9, 0xf0, 0xf9, 0x21}
+        };
+        const palette_point palette_cividis[] = {
+            {0, 0x00, 0x20, 0x4d}, {1, 0x00, 0x33, 0x6f}, {2, 0x39, 0x48, 0x6b},
+            {3, 0x57, 0x5c, 0x6d}, {4, 0x70, 0x71, 0x73}, {5, 0x8a, 0x87, 0x79},
+            {6, 0xa6, 0x9d, 0x75}, {7, 0xc4, 0xb5, 0x6c}, {8, 0xe4, 0xcf, 0x5b},
+            {9, 0xff, 0xea, 0x46}
+        };
+
+        struct builtin_palette {
+            const char *name;
+            const palette_point *points;
+            int count;
+        };
+
+#define BIN2GIF_PALETTE(name, points) \
+        {name, points, sizeof(points)/sizeof(points[0])}
+
+        const builtin_palette builtin_palettes[] = {
+            BIN2GIF_PALETTE("rainbow", palette_rainbow),
+            BIN2GIF_PALETTE("blue-red", palette_blue_red),
+            BIN2GIF_PALETTE("black-white", palette_black_white),
+            BIN2GIF_PALETTE("white-black", palette_white_black),
+            BIN2GIF_PALETTE("viridis", palette_viridis),
+            BIN2GIF_PALETTE("magma", palette_magma),
+            BIN2GIF_PALETTE("inferno", palette_inferno),
+            BIN2GIF_PALETTE("plasma", palette_plasma),
+            BIN2GIF_PALETTE("cividis", palette_cividis)
+        };
+
+#undef BIN2GIF_PALETTE
+
+        /**
+        * Generate palette from control points: point indexes are scaled to
+        * 0..255 and colors are interpolated linearly between them in
+        * floating point, rounded to nearest
+        */
+        void interpolate_palette(std::vector<palette_point> points,
+                                 color_palette *p_palette) {
+            int i = 0, k = 0, c = 0;
+
+            // Sort points from file, for newbies
+            std::stable_sort(points.begin(), points.end(),
+                             compare_palette_points);
+
+            double min = points.front().i;
+            double range = points.back().i - min;
+
+            for (i = 0; i < 256; i++) {
+                // Segment of points k, k + 1 containing color i
+                while (k + 2 < static_cast<int>(points.size()) &&
+                       (points[k + 1].i - min)*255 < i*range) {
+                    k++;
+                }
+
+                const palette_point &p1 = points[k];
+                const palette_point &p2 = points[k + 1];
+                double x1 = (p1.i - min)*255/range;
+                double x2 = (p2.i - min)*255/range;
+                double t = (x2 > x1) ? (i - x1)/(x2 - x1) : 1.0;
+                t = std::min(std::max(t, 0.0), 1.0);
+
+                int c1[3] = {p1.r, p1.g, p1.b};
+                int c2[3] = {p2.r, p2.g, p2.b};
+                for (c = 0; c < 3; c++) {
+                    p_palette->colors[i][c] =
+                        static_cast<int>(floor(c1[c] + (c2[c] - c1[c])*t + 0.5)); // NOLINT
+                }
+            }
         }
 
         /**
-        * Interpolate value by two coordinates
+        * Initialize color palette by built-in palette name or from file
+        * of "index red green blue" points, grayscale without name
+        * @return int 0 on success, 1 if palette cannot be read
         */
-        template<typename T>
-        T interpolate2D(double r1, double r2, double t1, double t2,
-                      T I11, T I12, T I21, T I22,  double r, double t) {
-            T I1121 = interpolate1D<T>(r1, r2, I11, I21, r);
-            T I1222 = interpolate1D<T>(r1, r2, I12, I22, r);
-            T I1121_1222 = interpolate1D<T>(t1, t2, I1121, I1222, t);
+        int init_color_palette(char* name, color_palette *p_palette) {
+            std::vector<palette_point> points;
+            palette_point pp;
+            int i = 0, k = 0;
+
+            if (!name || strcmp(name, "gray") == 0) {
+                for (i = 0; i < 256; i++) {
+                    p_palette->colors[i][0] = i;
+                    p_palette->colors[i][1] = i;
+                    p_palette->colors[i][2] = i;
+                }
+                return 0;
+            }
+
+            for (k = 0; k < static_cast<int>(sizeof(builtin_palettes)/sizeof(builtin_palettes[0])); k++) { // NOLINT
+                if (strcmp(name, builtin_palettes[k].name) == 0) {
+                    points.assign(builtin_palettes[k].points,
+                                  builtin_palettes[k].points +
+                                  builtin_palettes[k].count);
+                    interpolate_palette(points, p_palette);
+                    return 0;
+                }
+            }
+
+            FILE *fp = fopen(name, "r");
+            if (!fp) {
+                printf("Cannot open palette file %s, it is not a built-in palette either.\n", name); // NOLINT
+                return 1;
+            }
+
+            while (fscanf(fp, "%d %d %d %d",
+                          &pp.i, &pp.r, &pp.g, &pp.b) == 4) {
+                points.push_back(pp);
+            }
+            fclose(fp);
+
+            if (points.size() < 2) {
+                printf("Palette file %s has less than 2 colors.\n", name);
+                return 1;
+            }
+
+            std::stable_sort(points.begin(), points.end(),
+                             compare_palette_points);
+            if (points.front().i == points.back().i) {
+                printf("Palette file %s has all colors at one index.\n", name); // NOLINT
+                return 1;
+            }
 
-            T I1112 = interpolate1D<T>(t1, t2, I11, I12, t);
-            T I2122 = interpolate1D<T>(t1, t2, I21, I22, t);
-            T I1112_2122 = interpolate1D<T>(r1, r2, I1112, I2122, r);
+            interpolate_palette(points, p_palette);
 
-            return (I1121_1222 + I1112_2122)/2.;
+            return 0;
         }
 
         /**
-        * Array with palette colors
+        * Allocate array of count elements of binary file type
+        * @return void* Data, free it with free_binary_data
         */
-        int palette[256][3];
+        void* new_binary_data(binary_file_type file_type, size_t count) {
+            switch (file_type) {
+                case t_complex_double:
+                    return new std::complex<double>[count];
+                case t_float:
+                    return new float[count];
+                case t_complex_float:
+                    return new std::complex<float>[count];
+                case t_int16:
+                    return new int16_t[count];
+                case t_int32:
+                    return new int32_t[count];
+                case t_double:
+                default:
+                    return new double[count];
+            }
+        }
 
         /**
-        * Struct for palette point, readed from file
+        * Free data returned by get_data_from_binary_file
         */
-        struct palette_point {
-            int i;  // point index
+        void free_binary_data(void *data, bin2gif_job *p_job) {
+            if (p_job->map_base) {
+                fs::unmap_file(p_job->map_base, p_job->map_length);
+                p_job->map_base = NULL;
+                p_job->map_length = 0;
+                return;
+            }
 
-            int r;  // red channel
-            int g;  // green channel
-            int b;  // blue channel
-        };
+            switch (p_job->file_type) {
+                case t_complex_double:
+                    delete[] static_cast<std::complex<double>*>(data);
+                    break;
+                case t_float:
+                    delete[] static_cast<float*>(data);
+                    break;
+                case t_complex_float:
+                    delete[] static_cast<std::complex<float>*>(data);
+                    break;
+                case t_int16:
+                    delete[] static_cast<int16_t*>(data);
+                    break;
+                case t_int32:
+                    delete[] static_cast<int32_t*>(data);
+                    break;
+                case t_double:
+                default:
+                    delete[] static_cast<double*>(data);
+                    break;
+            }
+        }
 
         /**
-        * Comparison function for palette points
+        * Convert count elements of big-endian data to host byte order,
+        * complex values are swapped by parts
         */
-        bool compare_palette_points(palette_point a, palette_point b) {
-            if (a.i < b.i) {
-                return true;
+        void swap_binary_data(void *data, size_t count,
+                              binary_file_type file_type) {
+            size_t size = reduce::get_element_size(file_type);
+
+            if (reduce::is_complex_type(file_type)) {
+                count *= 2;
+                size /= 2;
+            }
+
+            simd::byteswap(data, count, size);
+        }
+
+        /**
+        * Determine square matrix file type, input and output sizes
+        * @return int 0 on success
+        */
+        int detect_square_matrix(char* filename, bin2gif_job *p_job) {
+            const bin2gif_parameters *p_params = p_job->p_params;
+
+            off_t file_size, elements_in_file;
+            int n = 0;
+
+            // Determine file type and image size {{{
+            file_size = fs::file_size(filename)
+                        - p_params->bin_header
+                        - p_params->bin_footer;
+            if (file_size <= 0) {
+                printf("Cannot determine file size.\n");
+                return 1;
+            }
+            if (p_params->bin_type >= 0) {
+                // Type is set by --type
+                p_job->file_type = static_cast<binary_file_type>(p_params->bin_type); // NOLINT
+                size_t element_size = reduce::get_element_size(p_job->file_type); // NOLINT
+
+                if (p_params->autodetect_bin_sizes) {
+                    elements_in_file = file_size / element_size;
+                    n = static_cast<off_t>(sqrt(static_cast<double>(elements_in_file))); // NOLINT
+                } else {
+                    elements_in_file = p_job->bin_width*p_job->bin_height;
+                    n = static_cast<off_t>(sqrt(static_cast<double>(elements_in_file))); // NOLINT
+                }
+
+                if (static_cast<off_t>(n)*n*static_cast<off_t>(element_size) != file_size) { // NOLINT
+                    printf("File size doesn't match %s square matrix.\n",
+                           reduce::get_file_type_name(p_job->file_type));
+                    return 1;
+                }
+
+                p_job->bin_width = n;
+                p_job->bin_height = n;
+            } else if (p_params->autodetect_bin_sizes) {
+                elements_in_file = file_size / sizeof(std::complex<double>);
+                n = static_cast<off_t>(sqrt(static_cast<double>(elements_in_file))); // NOLINT
+                if (elements_in_file != n*n) {
+                    p_job->file_type = t_double;
+                    elements_in_file = file_size / sizeof(double);
+                    n = static_cast<off_t>(sqrt(static_cast<double>(elements_in_file))); // NOLINT
+                }
+
+                p_job->bin_width = n;
+                p_job->bin_height = n;
             } else {
-                return false;
+                elements_in_file = p_job->bin_width*p_job->bin_height;
+                n = static_cast<off_t>(sqrt(static_cast<double>(elements_in_file))); // NOLINT
+                if (elements_in_file*sizeof(double) == file_size) {
+                    p_job->file_type = t_double;
+                } else if (elements_in_file*sizeof(std::complex<double>) == file_size) {
+                    p_job->file_type = t_complex_double;
+                } else {
+                    printf("Cannot determine file type.\n");
+                    return 1;
+                }
+
+                p_job->bin_width = n;
+                p_job->bin_height = n;
+            }
+            // }}}
+
+            // Region of matrix to draw, sampled by preview stride {{{
+            p_job->matrix_width = p_job->bin_width;
+            p_job->region_x = 0;
+            p_job->region_y = 0;
+            p_job->region_width = p_job->bin_width;
+            p_job->region_height = p_job->bin_height;
+            p_job->region_stride = p_params->preview_stride;
+
+            if (p_params->crop_width > 0) {
+                if (p_params->crop_x + p_params->crop_width > p_job->bin_width ||
+                    p_params->crop_y + p_params->crop_height > p_job->bin_height) { // NOLINT
+                    printf("Crop region %dx%d+%d+%d is out of matrix %dx%d.\n", // NOLINT
+                           p_params->crop_width, p_params->crop_height,
+                           p_params->crop_x, p_params->crop_y,
+                           p_job->bin_width, p_job->bin_height);
+                    return 1;
+                }
+
+                p_job->region_x = p_params->crop_x;
+                p_job->region_y = p_params->crop_y;
+                p_job->region_width = p_params->crop_width;
+                p_job->region_height = p_params->crop_height;
+            }
+
+            p_job->bin_width = (p_job->region_width + p_job->region_stride - 1)/
+                               p_job->region_stride;
+            p_job->bin_height = (p_job->region_height + p_job->region_stride - 1)/ // NOLINT
+                                p_job->region_stride;
+            // }}}
+
+            // No resize if --resize not specified {{{
+            if (p_job->to_width < 0) {
+                p_job->to_width = p_job->bin_width;
+            }
+
+            if (p_job->to_height < 0) {
+                p_job->to_height = p_job->bin_height;
             }
+            // }}}
+
+            return 0;
         }
 
         /**
-        * Initialize library color palette from file
-        * @return void
+        * Check if only part of matrix is read, by --crop or --preview
         */
-        void init_color_palette(char* filename) {
-            int i;
+        bool is_matrix_region(const bin2gif_job *p_job) {
+            return p_job->region_stride > 1 || p_job->p_params->crop_width > 0;
+        }
 
-            palette_point pp;
-            std::list<palette_point> plist;
-            std::list<palette_point>::iterator it, it_min, it_max;
-            int min, max;
-            palette_point p1, p2;
-
-            // Read palette from file
-            if (filename) {
-                FILE *fp = fopen(filename, "r");
-
-                while (fscanf(fp, "%d %d %d %d",
-                               &pp.i, &pp.r, &pp.g, &pp.b) == 4) {
-                    plist.push_back(pp);
-                }
-
-                // Generate palette from points
-                if (plist.size() >= 2) {
-                    // Sort point from file, for newbies
-                    plist.sort(compare_palette_points);
-
-                    // Scale indexes for 0..255
-                    it_min = min_element(plist.begin(), plist.end(),
-                                         compare_palette_points);
-                    it_max = max_element(plist.begin(), plist.end(),
-                                         compare_palette_points);
-                    min = (*it_min).i;
-                    max = (*it_max).i;
-
-                    for (it = plist.begin(); it != plist.end(); ++it) {
-                        (*it).i = ((*it).i - min)*255/(max-min);
-                    }
-
-                    // Set palette colors
-                    it = plist.begin();
-                    p1 = *it;
-                    ++it;
-                    p2 = *it;
-
-                    for (i = 0; i < 256; i++) {
-                        if (i > p2.i) {
-                            p1 = p2;
-                            ++it;
-                            p2 = *it;
+        /**
+        * Read region of square matrix, every region_stride row and column
+        * of it. Only row spans of region are read, rows are read by offset
+        * on all threads.
+        * @return void* Data, bin_width x bin_height, NULL on error
+        */
+        void* read_matrix_region(char* filename, bin2gif_job *p_job) {
+            const bin2gif_parameters *p_params = p_job->p_params;
+            int i = 0, j = 0, failed = 0;
+
+            size_t element_size = reduce::get_element_size(p_job->file_type);
+            size_t row_size = p_job->bin_width*element_size;
+            // Sampled row is read as one span from its first to last sample
+            size_t span_size = (static_cast<size_t>(p_job->bin_width - 1)*
+                                p_job->region_stride + 1)*element_size;
+
+            size_t count = static_cast<size_t>(p_job->bin_width)*
+                           p_job->bin_height;
+            char *data = static_cast<char*>(new_binary_data(p_job->file_type,
+                                                            count));
+            if (!data) {
+                printf("Cannot allocate memory for data.\n");
+                return NULL;
+            }
+
+            int fd = open(filename, O_RDONLY);
+            if (fd < 0) {
+                printf("Cannot open input file %s  for reading.\n",
+                       filename);
+                free_binary_data(data, p_job);
+                return NULL;
+            }
+
+            #pragma omp parallel private(i)
+            {
+                char *span = NULL;
+                if (p_job->region_stride > 1) {
+                    span = new char[span_size];
+                }
+
+                #pragma omp for schedule(static)
+                for (j = 0; j < p_job->bin_height; j++) {
+                    off_t row = p_job->region_y +
+                                static_cast<off_t>(j)*p_job->region_stride;
+                    off_t offset = p_params->bin_header +
+                                   (row*p_job->matrix_width + p_job->region_x)* // NOLINT
+                                   static_cast<off_t>(element_size);
+                    char *out = data + row_size*j;
+
+                    if (p_job->region_stride == 1) {
+                        if (fs::read_at(fd, out, row_size, offset) != 0) {
+                            #pragma omp atomic
+                            failed++;
                         }
+                        continue;
+                    }
 
-                        palette[i][0] = ((i - p1.i)*p2.r + (p2.i - i)*p1.r) /
-                                        (p2.i-p1.i);
-                        palette[i][1] = ((i - p1.i)*p2.g + (p2.i - i)*p1.g) /
-                                        (p2.i-p1.i);
-                        palette[i][2] = ((i - p1.i)*p2.b + (p2.i - i)*p1.b) /
-                                        (p2.i-p1.i);
+                    if (fs::read_at(fd, span, span_size, offset) != 0) {
+                        #pragma omp atomic
+                        failed++;
+                        continue;
                     }
 
-                    // All OK, return
-                    return;
+                    for (i = 0; i < p_job->bin_width; i++) {
+                        memcpy(out + i*element_size,
+                               span + static_cast<size_t>(i)*p_job->region_stride*element_size, // NOLINT
+                               element_size);
+                    }
+                }
+
+                delete[] span;
+            }
+
+            close(fd);
+
+            if (failed) {
+                printf("Error: Bad file format or corrupted file\n");
+                printf("Only %d rows of %d readed.\n",
+                       p_job->bin_height - failed, p_job->bin_height);
+                free_binary_data(data, p_job);
+                return NULL;
+            }
+
+            if (p_params->byteswap) {
+                swap_binary_data(data, count, p_job->file_type);
+            }
+
+            return data;
+        }
+
+        /**
+        * Radial interpolation table of --axial square: for every output
+        * pixel the bracket k on grid_r, -1 outside radius, and weights
+        * of points k and k+1
+        */
+        struct axial_table {
+            std::vector<int> k;
+            std::vector<double> w1;
+            std::vector<double> w2;
+        };
+
+        /**
+        * Get interpolation table for grid and image size. Series of files
+        * usually share one grid, so tables are built once and kept by grid
+        * hash for the whole run.
+        */
+        const axial_table* get_axial_table(const double *grid_r, int nr,
+                                           double radius,
+                                           int to_width, int to_height) {
+            static std::map<std::string, axial_table> tables;
+
+            const unsigned long long prime = 0x100000001b3ULL;
+            unsigned long long h = 0xcbf29ce484222325ULL;
+            const unsigned char *bytes =
+                reinterpret_cast<const unsigned char*>(grid_r);
+            size_t n = 0;
+            char key[64];
+
+            for (n = 0; n < nr*sizeof(double); n++) {
+                h = (h ^ bytes[n])*prime;
+            }
+            snprintf(key, sizeof(key), "%016llx:%d:%dx%d",
+                     h, nr, to_width, to_height);
+
+            // Tables are added to map only when filled, so table found
+            // is complete; map nodes are not moved by later insertions
+            const axial_table *p_table = NULL;
+
+            #pragma omp critical(axial_tables)
+            {
+                std::map<std::string, axial_table>::iterator it =
+                    tables.find(key);
+                if (it != tables.end()) {
+                    p_table = &it->second;
+                }
+            }
+
+            if (p_table) {
+                return p_table;
+            }
+
+            // Other files are converted meanwhile, so build into own table
+            // without lock; if another file publishes the same table first,
+            // it is used and own one is dropped
+            axial_table table;
+            size_t pixels = static_cast<size_t>(to_width)*to_height;
+            int i = 0, j = 0;
+
+            table.k.resize(pixels);
+            table.w1.resize(pixels);
+            table.w2.resize(pixels);
+
+            #pragma omp parallel for private(i) schedule(static)
+            for (j = 0; j < to_height; j++) {
+                for (i = 0; i < to_width; i++) {
+                    size_t idx = static_cast<size_t>(to_width)*j + i;
+                    double r = 4*static_cast<double>(
+                                   (j-to_height/2)*(j-to_height/2) +
+                                   (i-to_height/2)*(i-to_height/2))
+                               / to_height/to_height;
+                    r = sqrt(r)*radius;
+
+                    if (r < radius) {
+                        int k = std::upper_bound(grid_r, grid_r + nr, r)
+                                - grid_r - 1;
+                        k = std::max(0, std::min(k, nr - 2));
+
+                        table.k[idx] = k;
+                        table.w1[idx] = (grid_r[k+1] - r)/
+                                        (grid_r[k+1] - grid_r[k]);
+                        table.w2[idx] = (r - grid_r[k])/
+                                        (grid_r[k+1] - grid_r[k]);
+                    } else {
+                        table.k[idx] = -1;
+                        table.w1[idx] = 0;
+                        table.w2[idx] = 0;
+                    }
+                }
+            }
+
+            #pragma omp critical(axial_tables)
+            {
+                std::map<std::string, axial_table>::iterator it =
+                    tables.find(key);
+                if (it == tables.end()) {
+                    it = tables.insert(std::make_pair(std::string(key),
+                                                      axial_table())).first;
+                    it->second.k.swap(table.k);
+                    it->second.w1.swap(table.w1);
+                    it->second.w2.swap(table.w2);
+                }
+                p_table = &it->second;
+            }
+
+            return p_table;
+        }
+
+        /**
+        * Gather and blend radial layer into square by table,
+        * rows are independent
+        */
+        template<typename T>
+        void blend_axial_table(const axial_table *p_table, const T *layer,
+                               int to_width, int to_height, T *out) {
+            const int *table_k = &p_table->k[0];
+            const double *w1 = &p_table->w1[0];
+            const double *w2 = &p_table->w2[0];
+            int i = 0, j = 0;
+
+            #pragma omp parallel for private(i) schedule(static)
+            for (j = 0; j < to_height; j++) {
+                size_t row = static_cast<size_t>(to_width)*j;
+
+                for (i = 0; i < to_width; i++) {
+                    int k = table_k[row + i];
+
+                    out[row + i] = (k < 0) ? T(0)
+                                           : layer[k]*w1[row + i] +
+                                             layer[k+1]*w2[row + i];
+                }
+            }
+        }
+
+        /**
+        * Brackets on axial grid and interpolation weights of points k
+        * and k+1 for every output coordinate along one axis
+        */
+        struct axis_weights {
+            std::vector<int> k;
+            std::vector<double> w1;
+            std::vector<double> w2;
+        };
+
+        void init_axis_weights(const double *grid, int n,
+                               const std::vector<double> &coords,
+                               axis_weights *p_weights) {
+            size_t i = 0;
+
+            p_weights->k.resize(coords.size());
+            p_weights->w1.resize(coords.size());
+            p_weights->w2.resize(coords.size());
+
+            for (i = 0; i < coords.size(); i++) {
+                int k = std::upper_bound(grid, grid + n, coords[i]) - grid - 1;
+                k = std::max(0, std::min(k, n - 2));
+
+                p_weights->k[i] = k;
+                p_weights->w1[i] = (grid[k+1] - coords[i])/(grid[k+1] - grid[k]);
+                p_weights->w2[i] = (coords[i] - grid[k])/(grid[k+1] - grid[k]);
+            }
+        }
+
+        /**
+        * Resample RT plane into right half of image by separable bilinear
+        * weights, left half is its mirror. Bands of t rows are
+        * independent and run on separate threads.
+        */
+        template<typename T>
+        void blend_axial_plane(const T *axdata, int nr,
+                               const axis_weights &weights_r,
+                               const axis_weights &weights_t,
+                               int to_width, int to_height, T *out) {
+            const int *k_r = &weights_r.k[0];
+            const double *r1 = &weights_r.w1[0];
+            const double *r2 = &weights_r.w2[0];
+            int half = to_width/2;
+            int i = 0, j = 0;
+
+            #pragma omp parallel for private(i) schedule(static)
+            for (j = 0; j < to_height; j++) {
+                const T *row1 = axdata + static_cast<size_t>(nr)*weights_t.k[j]; // NOLINT
+                const T *row2 = row1 + nr;
+                double t1 = weights_t.w1[j], t2 = weights_t.w2[j];
+                T *out_row = out + static_cast<size_t>(to_width)*j;
+
+                for (i = 0; i < half; i++) {
+                    int k = k_r[i];
+                    out_row[half + i] = (row1[k]*r1[i] + row1[k+1]*r2[i])*t1 +
+                                        (row2[k]*r1[i] + row2[k+1]*r2[i])*t2;
+                }
+
+                for (i = 0; i < half; i++) {
+                    out_row[half - 1 - i] = out_row[half + i];
+                }
+
+                // Odd width has no pair for the last column
+                for (i = 2*half; i < to_width; i++) {
+                    out_row[i] = T(0);
                 }
             }
+        }
+
+        /**
+        * Read header of axial file: Nr, r grid, Nt and t grid
+        * @param p_offset Offset of data after header
+        * @return int 0 on success, grids are allocated then
+        */
+        int read_axial_header(int fd, char* filename, bool swap,
+                              int *p_nr, double **p_grid_r,
+                              int *p_nt, double **p_grid_t,
+                              off_t *p_offset) {
+            int nr = 0, nt = 0;
+            off_t offset = 0;
+
+            if (fs::read_at(fd, &nr, sizeof(nr), offset) == 0 && swap) {
+                simd::byteswap(&nr, 1, sizeof(nr));
+            }
+            if (nr < 2) {
+                printf("Cannot read Nr from file %s.\n", filename);
+                return 1;
+            }
+            offset += sizeof(nr);
+
+            double *grid_r = new double[nr];
+            if (fs::read_at(fd, grid_r, nr*sizeof(double), offset) != 0) {
+                printf("Cannot read grid_r from file %s.\n", filename);
+                delete[] grid_r;
+                return 1;
+            }
+            offset += nr*sizeof(double);
+
+            if (fs::read_at(fd, &nt, sizeof(nt), offset) == 0 && swap) {
+                simd::byteswap(&nt, 1, sizeof(nt));
+            }
+            if (nt < 1) {
+                printf("Cannot read Nt from file %s.\n", filename);
+                delete[] grid_r;
+                return 1;
+            }
+            offset += sizeof(nt);
+
+            double *grid_t = new double[nt];
+            if (fs::read_at(fd, grid_t, nt*sizeof(double), offset) != 0) {
+                printf("Cannot read grid_t from file %s.\n", filename);
+                delete[] grid_r;
+                delete[] grid_t;
+                return 1;
+            }
+            offset += nt*sizeof(double);
 
-            // OTHERWISE
-            // Generate simple grayscale palette
-            for ( i = 0; i < 256; i++ ) {
-                palette[i][0] = i;
-                palette[i][1] = i;
-                palette[i][2] = i;
+            if (swap) {
+                simd::byteswap(grid_r, nr, sizeof(double));
+                simd::byteswap(grid_t, nt, sizeof(double));
             }
+
+            *p_nr = nr;
+            *p_grid_r = grid_r;
+            *p_nt = nt;
+            *p_grid_t = grid_t;
+            *p_offset = offset;
+
+            return 0;
         }
 
-        void* get_data_from_binary_file(char* filename,
-                                        bin2gif_parameters *p_params) {
+        /**
+        * Read data from file and convert it to square matrix.
+        * Square matrix with aligned header is mapped from file without copy.
+        * @return void* Data, free it with free_binary_data
+        */
+        void* get_data_from_binary_file(char* filename, bin2gif_job *p_job) {
+            const bin2gif_parameters *p_params = p_job->p_params;
             FILE* fp = NULL;
 
             int i = 0, j = 0;
-            int n = 0;
 
-            p_params->file_type = t_complex_double;
-            off_t file_size, elements_in_file;
+            p_job->file_type = t_complex_double;
+            off_t elements_in_file;
             void *data;
             std::complex<double> *data_cd;
             double *data_d;
 
             if (p_params->bin_axial || p_params->bin_axial_all) {
                 // TODO(Sannis): Add filetype determining {{{
-                if (p_params->bin_type == 'c') {
-                    p_params->file_type = t_complex_double;
-                } else if (p_params->bin_type == 'd') {
-                    p_params->file_type = t_double;
+                if (p_params->bin_type == t_complex_double ||
+                    p_params->bin_type == t_double) {
+                    p_job->file_type = static_cast<binary_file_type>(p_params->bin_type); // NOLINT
                 } else {
+                    printf("Axial data type should be set to double or complex by --type.\n"); // NOLINT
                     return NULL;
                 }
                 // }}}
 
                 int nr = 0, nt = 0;
                 double *grid_r = NULL, *grid_t = NULL;
+                off_t offset = 0;
 
-                fp = fopen(filename, "r");
+                // Input may be already opened for several layers
+                int fd = p_job->axial_fd;
+                if (fd < 0) {
+                    fd = open(filename, O_RDONLY);
+                }
 
-                if ( !fp ) {
+                if (fd < 0) {
                     printf("Cannot open input file %s  for reading.\n",
                            filename);
                     return NULL;
                 }
 
-                if (fread(&nr, sizeof(nr), 1, fp) != 1) {
-                    printf("Cannot read Nr from file %s.\n",
-                           filename);
-                    fclose(fp);
+                if (read_axial_header(fd, filename, p_params->byteswap,
+                                      &nr, &grid_r, &nt, &grid_t,
+                                      &offset) != 0) {
+                    if (p_job->axial_fd < 0) {
+                        close(fd);
+                    }
                     return NULL;
                 }
 
-                grid_r = new double[nr];
-                if (!grid_r) {
-                    printf("Cannot allocate memory for data.\n");
-                    fclose(fp);
-                    return NULL;
-                }
+                size_t element_size = reduce::get_element_size(p_job->file_type); // NOLINT
 
-                if (fread(grid_r, sizeof(double), nr, fp) != nr) {
-                    printf("Cannot read grid_r from file %s.\n",
-                           filename);
-                    delete[] grid_r;
-                    fclose(fp);
-                    return NULL;
-                }
+                // Only one time layer is drawn by --axial, read just it
+                size_t layers_count = nt;
+                if (p_params->bin_axial) {
+                    int layer = (p_job->layer >= 0) ? p_job->layer
+                                                    : (nt-1)/2;
 
-                if (fread(&nt, sizeof(nt), 1, fp) != 1) {
-                    printf("Cannot read Nt from file %s.\n",
-                           filename);
-                    delete[] grid_r;
-                    fclose(fp);
-                    return NULL;
+                    if (layer >= nt) {
+                        printf("Cannot read layer %d from file %s, it has %d layers.\n", // NOLINT
+                               layer, filename, nt);
+                        delete[] grid_r;
+                        delete[] grid_t;
+                        if (p_job->axial_fd < 0) {
+                            close(fd);
+                        }
+                        return NULL;
+                    }
+
+                    if (p_params->debug) {
+                        printf("layer: %d of %d\n", layer, nt);
+                    }
+
+                    offset += static_cast<off_t>(nr)*layer*element_size;
+                    layers_count = 1;
                 }
 
-                grid_t = new double[nt];
-                if (!grid_t) {
+                void *axdata;
+                if (p_job->file_type == t_complex_double) {
+                    axdata = new std::complex<double>[nr*layers_count];
+                } else {
+                    axdata = new double[nr*layers_count];
+                }
+                if (!axdata) {
                     printf("Cannot allocate memory for data.\n");
                     delete[] grid_r;
-                    fclose(fp);
-                    return NULL;
-                }
-
-                if (fread(grid_t, sizeof(double), nt, fp) != nt) {
-                    printf("Cannot read grid_t from file %s.\n",
-                           filename);
-                    delete[] grid_r;
-                    delete[] grid_t;
-                    fclose(fp);
-                    return NULL;
-                }
-
-                void *axdata;
-                if (p_params->file_type == t_complex_double) {
-                    axdata = new std::complex<double>[nr*nt];
-                } else {
-                    axdata = new double[nr*nt];
-                }
-                if (!axdata) {
-                    printf("Cannot allocate memory for data.\n");
-                    delete[] grid_r;
-                    delete[] grid_t;
-                    fclose(fp);
+                    delete[] grid_t;
+                    if (p_job->axial_fd < 0) {
+                        close(fd);
+                    }
                     return NULL;
                 }
                 std::complex<double> *axdata_cd = static_cast<std::complex<double>*>(axdata); // NOLINT
                 double *axdata_d = static_cast<double*>(axdata);
 
-                if (p_params->file_type == t_complex_double) {
-                    elements_in_file = fread(axdata, sizeof(std::complex<double>),
-                                             nr*nt, fp);
-                } else {
-                    elements_in_file = fread(axdata, sizeof(double),
-                                             nr*nt, fp);
+                int read_result = fs::read_at(fd, axdata,
+                                              nr*layers_count*element_size,
+                                              offset);
+
+                if (p_job->axial_fd < 0) {
+                    close(fd);
                 }
-                if (elements_in_file != nr*nt) {
-                    printf("Cannot read axial data from file %s. Read %d %s elements, but %d expected.\n", filename, elements_in_file, (p_params->file_type == t_complex_double) ? "double" : "std::complex", nr*nt); // NOLINT
+
+                if (read_result != 0) {
+                    printf("Cannot read axial data from file %s. Expected %ld %s elements.\n", filename, static_cast<long>(nr*layers_count), reduce::get_file_type_name(p_job->file_type)); // NOLINT
                     delete[] grid_r;
                     delete[] grid_t;
                     delete[] axdata;
-                    fclose(fp);
                     return NULL;
                 }
 
-                fclose(fp);
-
-                if (p_params->bin_axial) {  // Draw only T=0 cut
-                    // Slice central time layer
-                    if (p_params->file_type == t_complex_double) {
-                        axdata_cd += nr*((nt-1)/2);
-                    } else {
-                        axdata_d += nr*((nt-1)/2);
-                    }
+                if (p_params->byteswap) {
+                    swap_binary_data(axdata, nr*layers_count, p_job->file_type);
+                }
 
+                if (p_params->bin_axial) {  // Draw one time layer, T=0 cut by default
                     // Convert axial to square
-                    double radius = (grid_r[nr-1] + grid_r[nr-2])/2, r = 0;
-                    p_params->sr = radius;
+                    double radius = (grid_r[nr-1] + grid_r[nr-2])/2;
+                    p_job->sr = radius;
 
 
-                    if (p_params->to_width < 0) {
-                        p_params->to_width = 2*static_cast<int>( radius / sqrt((grid_r[nr-1]-grid_r[nr-2])*(grid_r[1]-grid_r[0])) ) + 1; // NOLINT
+                    if (p_job->to_width < 0) {
+                        p_job->to_width = 2*static_cast<int>( radius / sqrt((grid_r[nr-1]-grid_r[nr-2])*(grid_r[1]-grid_r[0])) ) + 1; // NOLINT
                     }
-                    p_params->to_height = p_params->to_width;
+                    p_job->to_height = p_job->to_width;
 
-                    if (p_params->file_type == t_complex_double) {
-                        data = new std::complex<double>[p_params->to_width*p_params->to_height]; // NOLINT
+                    if (p_job->file_type == t_complex_double) {
+                        data = new std::complex<double>[p_job->to_width*p_job->to_height]; // NOLINT
                     } else {
-                        data = new double[p_params->to_width*p_params->to_height]; // NOLINT
+                        data = new double[p_job->to_width*p_job->to_height]; // NOLINT
                     }
                     if (!data) {
                         printf("Cannot allocate memory for data.\n");
@@ -302,46 +894,18 @@ namespace sns {
                     data_cd = static_cast<std::complex<double>*>(data);
                     data_d = static_cast<double*>(data);
 
-                    // Convert axial to square
-                    int k = 0;
-                    for (j = 0; j < p_params->to_height; j++) {
-                        for (i = 0; i < p_params->to_width; i++) {
-                            r = 4*static_cast<double>(
-                                    (j-p_params->to_height/2)*(j-p_params->to_height/2) + // NOLINT
-                                    (i-p_params->to_height/2)*(i-p_params->to_height/2)) // NOLINT
-                                / p_params->to_height/p_params->to_height;
-                            r = sqrt(r)*radius;
-
-                            if (r < radius) {
-                                if (r < grid_r[k]) {
-                                    for (; k >= 0; k--) {
-                                        if (grid_r[k] <= r && r <= grid_r[k + 1]) { // NOLINT
-                                            break;
-                                        }
-                                    }
-                                } else {
-                                    for (; k < nr-1; k++) {
-                                        if (grid_r[k] <= r && r <= grid_r[k + 1]) { // NOLINT
-                                            break;
-                                        }
-                                    }
-                                }
-
-                                if (p_params->file_type == t_complex_double) {
-                                    data_cd[p_params->to_width*j+i] =
-                                        interpolate1D< std::complex<double> >(grid_r[k], grid_r[k+1], axdata_cd[k], axdata_cd[k+1], r); // NOLINT
-                                } else {
-                                    data_d[p_params->to_width*j+i] =
-                                        interpolate1D< double >(grid_r[k], grid_r[k+1], axdata_d[k], axdata_d[k+1], r); // NOLINT
-                                }
-                            } else {
-                                if (p_params->file_type == t_complex_double) {
-                                    data_cd[p_params->to_width*j+i] = 0;
-                                } else {
-                                    data_d[p_params->to_width*j+i] = 0;
-                                }
-                            }
-                        }
+                    // Convert axial to square by interpolation table
+                    const axial_table *p_table = get_axial_table(
+                        grid_r, nr, radius, p_job->to_width, p_job->to_height);
+
+                    if (p_job->file_type == t_complex_double) {
+                        blend_axial_table< std::complex<double> >(p_table,
+                            axdata_cd, p_job->to_width, p_job->to_height,
+                            data_cd);
+                    } else {
+                        blend_axial_table<double>(p_table,
+                            axdata_d, p_job->to_width, p_job->to_height,
+                            data_d);
                     }
                 } else {  // Draw all RT plane
                     if (nt < 3) {
@@ -351,514 +915,1937 @@ namespace sns {
                         return NULL;
                     }
 
-                    // Convert axial to square
-                    p_params->sr = (grid_r[nr-1] + grid_r[nr-2])/2;
-                    p_params->st = (grid_t[nt-1] + grid_t[nt-2])/2;
-                    double r = 0, t = 0;
+                    p_job->sr = (grid_r[nr-1] + grid_r[nr-2])/2;
+                    p_job->st = (grid_t[nt-1] + grid_t[nt-2])/2;
+
+                    if (p_params->debug) {
+                        printf("sr: %lf\n", p_job->sr);
+                        printf("st: %lf\n", p_job->st);
+                    }
+
+                    if (p_job->to_width < 0) {
+                        p_job->to_width = 2*static_cast<int>( p_job->sr / sqrt((grid_r[nr-1]-grid_r[nr-2])*(grid_r[1]-grid_r[0])) ) + 1; // NOLINT
+                    }
+                    if (p_job->to_height < 0) {
+                        p_job->to_height = 2*static_cast<int>( p_job->st / sqrt((grid_t[nt-1]-grid_t[nt-2])*(grid_t[static_cast<int>((nt-1)/2)-1]-grid_t[static_cast<int>((nt-1)/2)])) ) + 1; // NOLINT
+                    }
+
+                    // Debug {{{
+                    if (p_params->debug) {
+                        // printf("\033[0;33mDebug {{{\n");
+
+                        printf("In --axial-all\n");
+                        printf("to_width: %d\n", p_job->to_width);
+                        printf("to_height: %d\n", p_job->to_height);
+                        printf("sr: %lf\n", p_job->sr);
+                        printf("st: %lf\n", p_job->st);
+
+                        // printf("Debug }}}\033[0m\n");
+                    }
+
+                    if (p_job->file_type == t_complex_double) {
+                        data = new std::complex<double>[
+                                   p_job->to_width*p_job->to_height
+                               ];
+                    } else {
+                        data = new double[
+                                   p_job->to_width*p_job->to_height
+                               ];
+                    }
+                    if (!data) {
+                        printf("Cannot allocate memory for data.\n");
+                        delete[] grid_r;
+                        delete[] grid_t;
+                        delete[] axdata;
+                        return NULL;
+                    }
+                    data_cd = static_cast<std::complex<double>*>(data);
+                    data_d = static_cast<double*>(data);
+
+                    // Convert axial to square by separable weights
+                    std::vector<double> coords_r(p_job->to_width/2);
+                    std::vector<double> coords_t(p_job->to_height);
+                    axis_weights weights_r, weights_t;
+
+                    for (i = 0; i < p_job->to_width/2; i++) {
+                        coords_r[i] = p_job->sr * 2 * static_cast<double>(i) / p_job->to_width; // NOLINT
+                    }
+                    for (j = 0; j < p_job->to_height; j++) {
+                        coords_t[j] = p_job->st * 2 * static_cast<double>(j - p_job->to_height/2) / p_job->to_height; // NOLINT
+                    }
+
+                    init_axis_weights(grid_r, nr, coords_r, &weights_r);
+                    init_axis_weights(grid_t, nt, coords_t, &weights_t);
+
+                    if (p_job->file_type == t_complex_double) {
+                        blend_axial_plane< std::complex<double> >(axdata_cd,
+                            nr, weights_r, weights_t,
+                            p_job->to_width, p_job->to_height, data_cd);
+                    } else {
+                        blend_axial_plane<double>(axdata_d,
+                            nr, weights_r, weights_t,
+                            p_job->to_width, p_job->to_height, data_d);
+                    }
+                }
+
+                // Temp hack
+                p_job->bin_width = p_job->to_width;
+                p_job->bin_height = p_job->to_height;
+
+                delete[] axdata;
+            } else {  // Standart square matrix
+                if (detect_square_matrix(filename, p_job) != 0) {
+                    return NULL;
+                }
+
+                if (is_matrix_region(p_job)) {
+                    return read_matrix_region(filename, p_job);
+                }
+
+                off_t bin_count = static_cast<off_t>(p_job->bin_width)*p_job->bin_height; // NOLINT
+
+                size_t element_size = reduce::get_element_size(p_job->file_type); // NOLINT
+
+                // Read data in place from file mapping if it is aligned
+                // and needs no byte swap {{{
+                if (p_params->bin_header % sizeof(double) == 0 &&
+                    !p_params->byteswap) {
+                    size_t map_length = 0;
+                    void *map = fs::map_file(filename, &map_length);
+
+                    if (map && map_length >= p_params->bin_header +
+                                             bin_count*element_size) {
+                        p_job->map_base = map;
+                        p_job->map_length = map_length;
+                        return static_cast<char*>(map) + p_params->bin_header;
+                    }
+
+                    if (map) {
+                        fs::unmap_file(map, map_length);
+                    }
+                }
+                // }}}
+
+                data = new_binary_data(p_job->file_type, bin_count);
+                if (!data) {
+                    printf("Cannot allocate memory for data.\n");
+                    return NULL;
+                }
+
+                fp = fopen(filename, "r");
+
+                if (!fp) {
+                    printf("Cannot open input file %s  for reading.\n",
+                           filename);
+                    free_binary_data(data, p_job);
+                    return NULL;
+                }
+
+                fseek(fp, p_params->bin_header, SEEK_SET);
+
+                elements_in_file = fread(data, element_size, bin_count, fp);
+
+                if (elements_in_file != bin_count) {
+                    printf("Error: Bad file format or corrupted file\n");
+                    printf("Only %ld elements of %ld readed.\n",
+                           elements_in_file, bin_count);
+                    free_binary_data(data, p_job);
+                    fclose(fp);
+                    return NULL;
+                }
+
+                fclose(fp);
+
+                if (p_params->byteswap) {
+                    swap_binary_data(data, bin_count, p_job->file_type);
+                }
+            }
+
+            return data;
+        }
+
+        /**
+        * Estimate peak memory used by file conversion: raw data, data
+        * converted to square matrix, reduced data and GD image
+        * @return off_t Bytes
+        */
+        off_t estimate_memory_usage(char* filename_bin,
+                                    const bin2gif_parameters *p_params) {
+            off_t data_size = fs::file_size(filename_bin)
+                              - p_params->bin_header
+                              - p_params->bin_footer;
+            off_t pixels = 0;
+
+            if (data_size < 0) {
+                data_size = 0;
+            }
+
+            // Only region of matrix is read
+            if (p_params->crop_width > 0) {
+                data_size = std::min(data_size,
+                                     static_cast<off_t>(p_params->crop_width)*
+                                     p_params->crop_height*
+                                     static_cast<off_t>(sizeof(std::complex<double>))); // NOLINT
+            }
+            if (p_params->preview_stride > 1) {
+                data_size /= static_cast<off_t>(p_params->preview_stride)*
+                             p_params->preview_stride;
+            }
+
+            if (p_params->to_width > 0 && p_params->to_height > 0) {
+                pixels = static_cast<off_t>(p_params->to_width)*
+                         p_params->to_height;
+            } else {
+                // No resize, at most one pixel per element in file
+                pixels = data_size /
+                         ((p_params->bin_type >= 0)
+                          ? reduce::get_element_size(static_cast<binary_file_type>(p_params->bin_type)) // NOLINT
+                          : sizeof(double));
+            }
+
+            if (p_params->stream &&
+                !(p_params->bin_axial || p_params->bin_axial_all)) {
+                // Only one stripe of input is held
+                if (p_params->to_height > 0) {
+                    data_size /= p_params->to_height;
+                } else {
+                    data_size /= sqrt(static_cast<double>(pixels) + 1);
+                }
+            }
+
+            // Reduced doubles of every function and palette image,
+            // one byte per pixel
+            off_t memory = data_size +
+                           pixels*(sizeof(double)*std::max(p_params->to_funcs_count, 1) + 1); // NOLINT
+            if (p_params->bin_axial || p_params->bin_axial_all) {
+                // Interpolated square matrix
+                memory += pixels*sizeof(std::complex<double>);
+            }
+            if (p_params->pyramid) {
+                // Next level of pyramid is reduced while previous one is held
+                memory += pixels*sizeof(double)/4;
+            }
+
+            return memory;
+        }
+
+        /**
+        * Find minimum and maximum of array on all threads.
+        * Every thread folds its band starting from the first array element,
+        * like std::min_element/std::max_element do, so merged result is
+        * the same as serial one even if array contains NaN values.
+        */
+        void find_min_max(const double *a, off_t n,
+                          double *p_min, double *p_max) {
+            double d_min = a[0], d_max = a[0];
+
+            #pragma omp parallel
+            {
+                double t_min = a[0], t_max = a[0];
+                off_t k;
+
+                #pragma omp for schedule(static) nowait
+                for (k = 1; k < n; k++) {
+                    if (a[k] < t_min) {
+                        t_min = a[k];
+                    }
+                    if (t_max < a[k]) {
+                        t_max = a[k];
+                    }
+                }
+
+                #pragma omp critical(find_min_max)
+                {
+                    if (t_min < d_min) {
+                        d_min = t_min;
+                    }
+                    if (d_max < t_max) {
+                        d_max = t_max;
+                    }
+                }
+            }
+
+            *p_min = d_min;
+            *p_max = d_max;
+        }
+
+        /**
+        * Order preserving key of double: sign bit is set for positive
+        * values, all bits are inverted for negative ones
+        */
+        inline uint64_t get_order_key(double d) {
+            uint64_t u = 0;
+            memcpy(&u, &d, sizeof(u));
+
+            return (u >> 63) ? ~u : (u | (1ULL << 63));
+        }
+
+        inline double get_key_value(uint64_t key) {
+            uint64_t u = (key >> 63) ? (key & ~(1ULL << 63)) : ~key;
+            double d = 0;
+            memcpy(&d, &u, sizeof(d));
+
+            return d;
+        }
+
+        /**
+        * Find values of percentiles p_low and p_high of finite array values
+        * by radix select over order preserving keys: every pass counts
+        * next 16 bits of keys whose higher bits match digits found so far,
+        * into histograms of every thread merged at the end. Array is
+        * neither copied nor sorted; NaN and infinite values are skipped.
+        * @return off_t Number of finite values, range is not set if 0
+        */
+        off_t find_percentile_range(const double *a, off_t n,
+                                    double p_low, double p_high,
+                                    double *p_min, double *p_max) {
+            const int bits = 16;
+            const int bins = 1 << bits;
+
+            off_t finite = 0, k = 0, total = 0;
+            int pass = 0, q = 0, b = 0;
+
+            #pragma omp parallel for reduction(+:finite) schedule(static)
+            for (k = 0; k < n; k++) {
+                if (std::isfinite(a[k])) {
+                    finite++;
+                }
+            }
+
+            if (finite == 0) {
+                return 0;
+            }
+
+            // Nearest rank of each percentile, then rank inside its bin
+            off_t ranks[2];
+            uint64_t prefixes[2] = {0, 0};
+            ranks[0] = static_cast<off_t>(floor(p_low/100*(finite - 1) + 0.5)); // NOLINT
+            ranks[1] = static_cast<off_t>(floor(p_high/100*(finite - 1) + 0.5)); // NOLINT
+
+            std::vector<off_t> histogram(2*bins);
+
+            for (pass = 0; pass < 64/bits; pass++) {
+                int shift = 64 - bits*(pass + 1);
+
+                std::fill(histogram.begin(), histogram.end(), 0);
+
+                #pragma omp parallel private(q, b)
+                {
+                    std::vector<off_t> local(2*bins, 0);
+
+                    #pragma omp for schedule(static) nowait
+                    for (k = 0; k < n; k++) {
+                        if (!std::isfinite(a[k])) {
+                            continue;
+                        }
+
+                        uint64_t key = get_order_key(a[k]);
+                        for (q = 0; q < 2; q++) {
+                            if (pass == 0 ||
+                                (key >> (shift + bits)) == prefixes[q]) {
+                                local[q*bins + ((key >> shift) & (bins - 1))]++; // NOLINT
+                            }
+                        }
+                    }
+
+                    #pragma omp critical(find_percentile_range)
+                    for (b = 0; b < 2*bins; b++) {
+                        histogram[b] += local[b];
+                    }
+                }
+
+                for (q = 0; q < 2; q++) {
+                    const off_t *counts = &histogram[q*bins];
+
+                    for (b = 0, total = 0; b < bins - 1; b++) {
+                        if (total + counts[b] > ranks[q]) {
+                            break;
+                        }
+                        total += counts[b];
+                    }
+
+                    ranks[q] -= total;
+                    prefixes[q] = (prefixes[q] << bits) | b;
+                }
+            }
+
+            *p_min = get_key_value(prefixes[0]);
+            *p_max = get_key_value(prefixes[1]);
+
+            return finite;
+        }
+
+        /**
+        * Reduce stripe of factor_y input rows into output row j by every
+        * function. Several functions are applied by column blocks of
+        * cache size, so stripe is read from memory once for all of them.
+        */
+        void reduce_stripe_funcs(const char *stripe, const bin2gif_job *p_job,
+                                 int factor_x, int factor_y,
+                                 const reduce::stripe_reducer *reducers,
+                                 int count, double **ddata, int j) {
+            const size_t block_size = 1 << 18;
+            off_t row = static_cast<off_t>(p_job->to_width)*j;
+            int i0 = 0, k = 0;
+
+            if (count == 1) {
+                reducers[0](stripe, p_job->bin_width, p_job->to_width,
+                            factor_x, factor_y, ddata[0] + row);
+                return;
+            }
+
+            size_t element_size = reduce::get_element_size(p_job->file_type);
+            size_t pixel_size = element_size*factor_x*factor_y;
+            int block_pixels = std::max(1, static_cast<int>(block_size/pixel_size)); // NOLINT
+
+            for (i0 = 0; i0 < p_job->to_width; i0 += block_pixels) {
+                int n = std::min(block_pixels, p_job->to_width - i0);
+
+                for (k = 0; k < count; k++) {
+                    reducers[k](stripe + element_size*factor_x*i0,
+                                p_job->bin_width, n, factor_x, factor_y,
+                                ddata[k] + row + i0);
+                }
+            }
+        }
+
+        /**
+        * Read square matrix by stripes of factor_y rows and reduce each
+        * stripe right away, so only one stripe of input is held in memory
+        * @return int 0 on success
+        */
+        int reduce_file_by_stripes(char* filename, const bin2gif_job *p_job,
+                                   int factor_x, int factor_y,
+                                   const reduce::stripe_reducer *reducers,
+                                   int count, double **ddata) {
+            const bin2gif_parameters *p_params = p_job->p_params;
+            int j = 0;
+
+            size_t element_size = reduce::get_element_size(p_job->file_type);
+            size_t stripe_count = static_cast<size_t>(p_job->bin_width)*
+                                  factor_y;
+
+            char *stripe = new char[stripe_count*element_size];
+            if (!stripe) {
+                printf("Cannot allocate memory for data.\n");
+                return 1;
+            }
+
+            FILE *fp = fopen(filename, "r");
+
+            if (!fp) {
+                printf("Cannot open input file %s  for reading.\n",
+                       filename);
+                delete[] stripe;
+                return 1;
+            }
+
+            posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+            fseek(fp, p_params->bin_header, SEEK_SET);
+
+            for (j = 0; j < p_job->to_height; j++) {
+                size_t elements_read = fread(stripe, element_size,
+                                             stripe_count, fp);
+                if (elements_read != stripe_count) {
+                    printf("Error: Bad file format or corrupted file\n");
+                    printf("Only %d rows of %d readed.\n",
+                           j*factor_y, p_job->to_height*factor_y);
+                    delete[] stripe;
+                    fclose(fp);
+                    return 1;
+                }
+
+                if (p_params->byteswap) {
+                    swap_binary_data(stripe, stripe_count, p_job->file_type);
+                }
+
+                reduce_stripe_funcs(stripe, p_job, factor_x, factor_y,
+                                    reducers, count, ddata, j);
+            }
+
+            delete[] stripe;
+            fclose(fp);
+
+            return 0;
+        }
+
+        /**
+        * Resample square matrix to output size by separable filter.
+        * Input row is converted by every function and resampled
+        * horizontally once, into ring of row buffers of each thread;
+        * output row is combined from the ring vertically. Output rows
+        * are resampled in bands on all threads. If data is NULL, rows
+        * are read from file by offset, so input is not held in memory.
+        * @return int 0 on success
+        */
+        int resample_file(char* filename, const bin2gif_job *p_job,
+                          const char *data,
+                          const reduce::stripe_reducer *reducers,
+                          int count, double **ddata) {
+            const bin2gif_parameters *p_params = p_job->p_params;
+            resample_filter filter = p_params->to_filter;
+            reduce::resample_axis axis_x, axis_y;
+            int j = 0, failed = 0, fd = -1;
+
+            reduce::init_resample_axis(p_job->bin_width, p_job->to_width,
+                                       filter, &axis_x);
+            reduce::init_resample_axis(p_job->bin_height, p_job->to_height,
+                                       filter, &axis_y);
+
+            size_t element_size = reduce::get_element_size(p_job->file_type);
+            size_t row_size = element_size*p_job->bin_width;
+            int width = p_job->to_width;
+            int ring_size = axis_y.taps;
+
+            if (!data) {
+                fd = open(filename, O_RDONLY);
+                if (fd < 0) {
+                    printf("Cannot open input file %s  for reading.\n",
+                           filename);
+                    return 1;
+                }
+            }
+
+            #pragma omp parallel
+            {
+                // Horizontally resampled rows of every function,
+                // input row r is kept in slot r % ring_size
+                std::vector<double> ring(static_cast<size_t>(ring_size)*count*width); // NOLINT
+                std::vector<int> ring_rows(ring_size, -1);
+                std::vector<double> values(p_job->bin_width);
+                std::vector<char> row_buffer(data ? 0 : row_size);
+                std::vector<const double*> rows(ring_size);
+                int k = 0, t = 0, r = 0, slot = 0;
+
+                #pragma omp for schedule(static)
+                for (j = 0; j < p_job->to_height; j++) {
+                    int start = axis_y.start[j];
+                    int n = axis_y.count[j];
+
+                    for (t = 0; t < n; t++) {
+                        r = start + t;
+                        slot = r % ring_size;
+                        if (ring_rows[slot] == r) {
+                            continue;
+                        }
+
+                        const char *in = NULL;
+                        if (data) {
+                            in = data + row_size*r;
+                        } else {
+                            off_t offset = p_params->bin_header +
+                                           static_cast<off_t>(row_size)*r;
+                            if (fs::read_at(fd, &row_buffer[0], row_size,
+                                            offset) != 0) {
+                                #pragma omp atomic
+                                failed++;
+                                memset(&row_buffer[0], 0, row_size);
+                            } else if (p_params->byteswap) {
+                                swap_binary_data(&row_buffer[0],
+                                                 p_job->bin_width,
+                                                 p_job->file_type);
+                            }
+                            in = &row_buffer[0];
+                        }
+
+                        for (k = 0; k < count; k++) {
+                            reducers[k](in, p_job->bin_width,
+                                        p_job->bin_width, 1, 1, &values[0]);
+                            reduce::resample_row(&values[0], axis_x, filter,
+                                                 &ring[(static_cast<size_t>(slot)*count + k)*width]); // NOLINT
+                        }
+                        ring_rows[slot] = r;
+                    }
+
+                    for (k = 0; k < count; k++) {
+                        for (t = 0; t < n; t++) {
+                            slot = (start + t) % ring_size;
+                            rows[t] = &ring[(static_cast<size_t>(slot)*count + k)*width]; // NOLINT
+                        }
+                        reduce::resample_column(&rows[0],
+                                                &axis_y.weights[static_cast<size_t>(j)*axis_y.taps], // NOLINT
+                                                n, filter, width,
+                                                ddata[k] + static_cast<off_t>(width)*j); // NOLINT
+                    }
+                }
+            }
+
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            if (failed) {
+                printf("Error: Bad file format or corrupted file\n");
+                printf("%d rows of %d not readed.\n",
+                       failed, p_job->bin_height);
+                return 1;
+            }
+
+            return 0;
+        }
+
+        /**
+        * Mapping of data values into image color indexes, built once per
+        * image: value is transformed by color scale, index is
+        * factor*value + offset.
+        * Log scales are looked up in table by high bits of magnitude,
+        * 8 bits of mantissa, so log10 is not taken per pixel.
+        */
+        struct color_mapping {
+            color_scale scale;
+            double factor;
+            double offset;
+
+            double lut_floor;    // magnitudes looked up are clamped to
+            double lut_ceil;     // [lut_floor, lut_ceil]
+            double lut_zero;     // transformed value of NaN and magnitudes
+                                 // below lut_floor
+            uint64_t lut_base;   // high bits of lut_floor
+            std::vector<double> lut;
+
+            int colors[256];     // image color index for palette color
+            bool identity;       // colors[i] == i
+        };
+
+        const int lut_shift = 44;  // 52 bits of mantissa - 8 bits kept
+
+        inline uint64_t get_double_bits(double d) {
+            uint64_t u = 0;
+            memcpy(&u, &d, sizeof(u));
+            return u;
+        }
+
+        inline double get_bits_double(uint64_t u) {
+            double d = 0;
+            memcpy(&d, &u, sizeof(d));
+            return d;
+        }
+
+        /**
+        * Transform of magnitude by color scale
+        */
+        double scale_magnitude(color_scale scale, double linthresh, double a) {
+            return (scale == cs_log) ? log10(a) : log10(1 + a/linthresh);
+        }
+
+        /**
+        * Build color mapping of data range [d_min, d_max].
+        * Log scale of range not above zero starts 6 decades below d_max,
+        * symlog linear range is 1e-3 of largest magnitude by default.
+        */
+        void init_color_mapping(const bin2gif_parameters *p_params,
+                                double d_min, double d_max,
+                                const int *colors,
+                                color_mapping *p_mapping) {
+            double t_min = d_min, t_max = d_max;
+            double linthresh = p_params->to_linthresh;
+            int i = 0;
+            size_t k = 0;
+
+            p_mapping->scale = p_params->to_scale;
+            p_mapping->identity = true;
+            for (i = 0; i < 256; i++) {
+                p_mapping->colors[i] = colors[i];
+                p_mapping->identity = p_mapping->identity && colors[i] == i;
+            }
+
+            if (p_mapping->scale == cs_log) {
+                p_mapping->lut_ceil = d_max;
+                p_mapping->lut_floor = (d_min > 0) ? d_min : d_max*1e-6;
+            } else if (p_mapping->scale == cs_symlog) {
+                p_mapping->lut_ceil = std::max(fabs(d_min), fabs(d_max));
+                if (linthresh <= 0) {
+                    linthresh = p_mapping->lut_ceil*1e-3;
+                }
+                p_mapping->lut_floor = std::min(linthresh, p_mapping->lut_ceil)/65536; // NOLINT
+            }
+
+            if (p_mapping->scale != cs_linear) {
+                if (!(p_mapping->lut_ceil > 0 && std::isfinite(p_mapping->lut_ceil)) || // NOLINT
+                    !(linthresh > 0 || p_mapping->scale == cs_log)) {
+                    // Nothing to draw in log scale, all pixels get color 0
+                    p_mapping->scale = cs_linear;
+                    p_mapping->factor = 0;
+                    p_mapping->offset = 0;
+                    return;
+                }
+
+                p_mapping->lut_base = get_double_bits(p_mapping->lut_floor) >> lut_shift; // NOLINT
+                p_mapping->lut.resize((get_double_bits(p_mapping->lut_ceil) >> lut_shift) - // NOLINT
+                                      p_mapping->lut_base + 1);
+
+                // Value in the middle of every bin, but within range
+                for (k = 0; k < p_mapping->lut.size(); k++) {
+                    double a = get_bits_double(((p_mapping->lut_base + k) << lut_shift) | // NOLINT
+                                               (1ULL << (lut_shift - 1)));
+                    a = std::min(std::max(a, p_mapping->lut_floor),
+                                 p_mapping->lut_ceil);
+                    p_mapping->lut[k] = scale_magnitude(p_mapping->scale,
+                                                        linthresh, a);
+                }
+
+                if (p_mapping->scale == cs_log) {
+                    p_mapping->lut_zero = p_mapping->lut[0];
+                    t_min = p_mapping->lut[0];
+                    t_max = p_mapping->lut.back();
+                } else {
+                    p_mapping->lut_zero = 0;
+                    t_min = ((d_min < 0) ? -1 : 1)*
+                            scale_magnitude(cs_symlog, linthresh, fabs(d_min)); // NOLINT
+                    t_max = ((d_max < 0) ? -1 : 1)*
+                            scale_magnitude(cs_symlog, linthresh, fabs(d_max)); // NOLINT
+                }
+
+                if (p_params->debug) {
+                    printf("scale: %s, lut: %d\n",
+                           (p_mapping->scale == cs_log) ? "log" : "symlog",
+                           static_cast<int>(p_mapping->lut.size()));
+                }
+            }
+
+            if (t_max > t_min) {
+                p_mapping->factor = 255/(t_max - t_min);
+                p_mapping->offset = -t_min*p_mapping->factor;
+            } else {
+                p_mapping->factor = 0;
+                p_mapping->offset = 0;
+            }
+        }
+
+        /**
+        * Map row of values into image palette indexes. Values of log
+        * scales are transformed into buffer first, it may be values.
+        */
+        void colormap_row(const double *values, int count,
+                          const color_mapping *p_mapping,
+                          double *buffer, unsigned char *indexes) {
+            const double factor = p_mapping->factor;
+            const double offset = p_mapping->offset;
+            int i = 0;
+
+            if (p_mapping->scale != cs_linear) {
+                const double *lut = &p_mapping->lut[0];
+                uint64_t base = p_mapping->lut_base;
+                double a_min = p_mapping->lut_floor;
+                double a_max = p_mapping->lut_ceil;
+                bool symmetric = p_mapping->scale == cs_symlog;
+
+                for (i = 0; i < count; i++) {
+                    double v = values[i];
+                    double a = symmetric ? fabs(v) : v;
+                    double t = p_mapping->lut_zero;
+
+                    // NaN and values below floor are not looked up,
+                    // NaN gets color 0
+                    if (a >= a_min) {
+                        a = (a < a_max) ? a : a_max;
+                        t = lut[(get_double_bits(a) >> lut_shift) - base];
+                        if (symmetric && v < 0) {
+                            t = -t;
+                        }
+                    } else if (v != v) {
+                        t = -HUGE_VAL;
+                    }
+
+                    buffer[i] = t;
+                }
+
+                values = buffer;
+            }
+
+            #pragma omp simd
+            for (i = 0; i < count; i++) {
+                double x = values[i]*factor + offset;
+                x = (x >= 0) ? x : 0;
+                x = (x < 255) ? x : 255;
+                indexes[i] = static_cast<unsigned char>(static_cast<int>(x));
+            }
+
+            if (!p_mapping->identity) {
+                for (i = 0; i < count; i++) {
+                    indexes[i] = p_mapping->colors[indexes[i]];
+                }
+            }
+        }
+
+        /**
+        * Colormap row j of output image, reflected image rows are data
+        * columns and are gathered into column buffer first
+        * @param column Buffer of image row size
+        */
+        void colormap_image_row(const double *ddata, const bin2gif_job *p_job,
+                                int j, const color_mapping *p_mapping,
+                                double *column, unsigned char *indexes) {
+            const double *values = ddata +
+                                   static_cast<off_t>(p_job->to_width)*j;
+            int count = p_job->to_width, i = 0;
+
+            if (p_job->p_params->to_reflect) {
+                count = p_job->to_height;
+                for (i = 0; i < count; i++) {
+                    column[i] = ddata[static_cast<off_t>(p_job->to_width)*i + j]; // NOLINT
+                }
+                values = column;
+            }
+
+            colormap_row(values, count, p_mapping, column, indexes);
+        }
+
+#ifdef BIN2GIF_USE_GD
+        /**
+        * Render reduced data as GD palette image and write it by libgd
+        * @return int Zero on success
+        */
+        int write_gif_image(char* filename_image, const double *ddata,
+                            const bin2gif_job *p_job,
+                            double d_min, double d_max) {
+            const bin2gif_parameters *p_params = p_job->p_params;
+            gdImagePtr im;
+            int i = 0, j = 0;
+
+            if (!p_params->to_reflect) {
+                im = gdImageCreate(p_job->to_width, p_job->to_height);
+            } else {
+                im = gdImageCreate(p_job->to_height, p_job->to_width);
+            }
+
+            if (!im) {
+                printf("Cannot create GD image.\n");
+                return 1;
+            }
+
+            // GIF palette is built once from color palette and pixels are
+            // set as palette indexes, so GD doesn't quantize image
+            int gd_colors[256];
+            for (i = 0; i < 256; i++) {
+                gd_colors[i] = gdImageColorAllocate(im,
+                                   p_params->palette.colors[i][0],
+                                   p_params->palette.colors[i][1],
+                                   p_params->palette.colors[i][2]);
+            }
+
+            color_mapping mapping;
+            init_color_mapping(p_params, d_min, d_max, gd_colors, &mapping);
+
+            // Image rows are independent, so split them between threads
+            #pragma omp parallel private(i)
+            {
+                unsigned char *indexes = NULL;
+                if (p_params->to_reflect) {
+                    indexes = new unsigned char[p_job->to_width];
+                }
+                double *buffer = new double[p_job->to_width];
+
+                #pragma omp for schedule(static)
+                for (j = 0; j < p_job->to_height; j++) {
+                    if (!p_params->to_reflect) {
+                        colormap_row(ddata + static_cast<off_t>(p_job->to_width)*j, // NOLINT
+                                     p_job->to_width, &mapping,
+                                     buffer, im->pixels[j]);
+                    } else {
+                        colormap_row(ddata + static_cast<off_t>(p_job->to_width)*j, // NOLINT
+                                     p_job->to_width, &mapping,
+                                     buffer, indexes);
+                        for (i = 0; i < p_job->to_width; i++) {
+                            im->pixels[i][j] = indexes[i];
+                        }
+                    }
+                }
+
+                delete[] buffer;
+                delete[] indexes;
+            }
+
+            FILE *fp = fopen(filename_image, "wb");
+
+            if (!fp) {
+                printf("Cannot open output file %s for writing.\n",
+                       filename_image);
+                gdImageDestroy(im);
+                return 1;
+            }
+
+            gdImageGif(im, fp);
+
+            fclose(fp);
+            gdImageDestroy(im);
+
+            return 0;
+        }
+#else
+        /**
+        * Render reduced data and write it by built-in GIF encoder.
+        * Single image: bands of rows are colormapped on all cores and
+        * passed to encoder in order, so indexed image is never held in full.
+        * With --gif-tiles image is split into horizontal tiles, each one
+        * is colormapped and LZW encoded by its own thread, and parts of
+        * code stream are joined into data of one image.
+        * @return int Zero on success
+        */
+        int write_gif_image(char* filename_image, const double *ddata,
+                            const bin2gif_job *p_job,
+                            double d_min, double d_max) {
+            const bin2gif_parameters *p_params = p_job->p_params;
+            const int band_rows = 64;
+
+            int width = p_job->to_width, height = p_job->to_height;
+            if (p_params->to_reflect) {
+                std::swap(width, height);
+            }
+
+            gif::gif_writer writer;
+            if (gif::open_gif(&writer, filename_image, width, height,
+                              &p_params->palette) != 0) {
+                printf("Cannot open output file %s for writing.\n",
+                       filename_image);
+                return 1;
+            }
+
+            // GIF color table is the palette itself
+            int colors[256];
+            int i = 0, j = 0, j0 = 0;
+            for (i = 0; i < 256; i++) {
+                colors[i] = i;
+            }
+
+            color_mapping mapping;
+            init_color_mapping(p_params, d_min, d_max, colors, &mapping);
+
+            int tiles = std::min(p_params->gif_tiles, height);
+            int tile_rows = (height + tiles - 1)/tiles;
+            tiles = (height + tile_rows - 1)/tile_rows;
+
+            if (tiles > 1) {
+                std::vector<gif::lzw_tile> tile_data(tiles);
+                int t = 0;
+
+                #pragma omp parallel private(j)
+                {
+                    gif::lzw_encoder *p_lzw = new gif::lzw_encoder;
+                    gif::init_lzw(p_lzw);
+
+                    double *column = new double[width];
+                    unsigned char *indexes = new unsigned char[width];
+
+                    #pragma omp for schedule(dynamic, 1)
+                    for (t = 0; t < tiles; t++) {
+                        int top = t*tile_rows;
+                        int rows = std::min(tile_rows, height - top);
+
+                        gif::begin_tile(p_lzw, &tile_data[t], t == 0);
+                        for (j = top; j < top + rows; j++) {
+                            colormap_image_row(ddata, p_job, j, &mapping,
+                                               column, indexes);
+                            gif::encode_lzw(p_lzw, indexes, width);
+                        }
+                        gif::end_tile(p_lzw, &tile_data[t], t == tiles - 1);
+                    }
+
+                    delete[] indexes;
+                    delete[] column;
+                    delete p_lzw;
+                }
+
+                // Parts are joined into code stream of one image
+                gif::begin_tiled_image(&writer, 0, 0, width, height);
+                for (t = 0; t < tiles; t++) {
+                    gif::write_tile(&writer, tile_data[t]);
+                    std::vector<unsigned char>().swap(tile_data[t].data);
+                }
+                gif::end_tiled_image(&writer);
+            } else {
+                unsigned char *band = new unsigned char[static_cast<size_t>(width)*band_rows]; // NOLINT
+
+                gif::begin_image(&writer, 0, 0, width, height);
+
+                #pragma omp parallel private(j, j0)
+                {
+                    double *column = new double[width];
+
+                    for (j0 = 0; j0 < height; j0 += band_rows) {
+                        int rows = std::min(band_rows, height - j0);
+
+                        #pragma omp for schedule(static)
+                        for (j = j0; j < j0 + rows; j++) {
+                            colormap_image_row(ddata, p_job, j, &mapping,
+                                               column,
+                                               band + static_cast<size_t>(width)*(j - j0)); // NOLINT
+                        }
+
+                        #pragma omp single
+                        gif::write_pixels(&writer, band,
+                                          static_cast<size_t>(width)*rows);
+                    }
+
+                    delete[] column;
+                }
+
+                gif::end_image(&writer);
+
+                delete[] band;
+            }
+
+            if (gif::close_gif(&writer) != 0) {
+                printf("Cannot write output file %s.\n", filename_image);
+                return 1;
+            }
+
+            return 0;
+        }
+#endif
+
+        /**
+        * Initialize per-file conversion state from program parameters
+        */
+        void init_job(bin2gif_job *p_job, const bin2gif_parameters *p_params) {
+            p_job->p_params = p_params;
+
+            p_job->file_type = t_complex_double;
+
+            p_job->bin_width = p_params->bin_width;
+            p_job->bin_height = p_params->bin_height;
+
+            p_job->to_width = p_params->to_width;
+            p_job->to_height = p_params->to_height;
+
+            p_job->sr = 0;
+            p_job->st = 0;
+
+            p_job->layer = p_params->layer_first;
+            p_job->axial_fd = -1;
+
+            p_job->map_base = NULL;
+            p_job->map_length = 0;
+        }
+
+        /**
+        * Color scale range for data range: fixed for arg, set by amplitude
+        * or --min/--max, batch range in --global-range mode
+        */
+        void get_color_range(const bin2gif_parameters *p_params,
+                             double *p_min, double *p_max) {
+            double d_min = *p_min, d_max = *p_max;
+
+            if (p_params->global_range) {
+                d_min = p_params->global_min;
+                d_max = p_params->global_max;
+            }
+
+            if (strcmp(p_params->to_func, "arg") == 0) {
+                if (p_params->debug) {
+                    // printf("\033[0;33mDebug {{{\n");
+                    printf("d_min: %lf\n", d_min);
+                    printf("d_max: %lf\n", d_max);
+                    // printf("Debug }}}\033[0m\n");
+                }
+
+                d_min = -M_PI;
+                d_max = M_PI;
+            } else if ((p_params->to_amp > 0) &&
+                        !(p_params->to_use_min ||
+                          p_params->to_use_max ||
+                          p_params->to_amp_e)
+                       ) {
+                d_min = ( (strcmp(p_params->to_func, "norm") == 0) ||
+                          (strcmp(p_params->to_func, "abs") == 0) ) ?
+                          0 : -p_params->to_amp;
+                d_max = p_params->to_amp;
+            } else if (p_params->to_amp_e) {
+                d_min = d_min/M_El;
+                d_max = d_max/M_El;
+            }
+
+            if (p_params->to_use_min) {
+                d_min = p_params->to_min;
+            }
+
+            if (p_params->to_use_max) {
+                d_max = p_params->to_max;
+            }
+
+            // Debug {{{
+            if (p_params->debug) {
+                // printf("\033[0;33mDebug {{{\n");
+                printf("d_min: %lf\n", d_min);
+                printf("d_max: %lf\n", d_max);
+                // printf("Debug }}}\033[0m\n");
+            }
+            // Debug }}}
+
+            *p_min = d_min;
+            *p_max = d_max;
+        }
+
+        /**
+        * Read binary file once and reduce it to output size by function
+        * of every job; jobs differ only by function, so sizes detected
+        * for the first one are set to all
+        * @param ddata Reduced data of every job
+        * @return int 0 on success
+        */
+        int read_and_reduce_file(char* filename_bin, bin2gif_job *jobs,
+                                 int count, double **ddata) {
+            bin2gif_job *p_job = &jobs[0];
+            const bin2gif_parameters *p_params = p_job->p_params;
+
+            int j = 0, k = 0;
+            int factor_x = 1, factor_y = 1;
+            bool stream = p_params->stream &&
+                          !(p_params->bin_axial || p_params->bin_axial_all) &&
+                          p_params->crop_width <= 0 &&
+                          p_params->preview_stride <= 1;
+
+            // Read data from file and convert to square matrix,
+            // in stream mode only determine sizes and read data later
+            void *data = NULL;
+            if (stream) {
+                if (detect_square_matrix(filename_bin, p_job) != 0) {
+                    return 1;
+                }
+            } else {
+                data = get_data_from_binary_file(filename_bin, p_job);
+                if (!data) {
+                    return 1;
+                }
+            }
+
+            // Integer ratio of area filter is plain box average,
+            // other sizes and filters are resampled by weights
+            bool box = p_params->to_filter == rs_area &&
+                       p_job->bin_width % p_job->to_width == 0 &&
+                       p_job->bin_height % p_job->to_height == 0;
+            factor_x = p_job->bin_width/p_job->to_width;
+            factor_y = p_job->bin_height/p_job->to_height;
+
+            // Choose reduction kernels once per file
+            std::vector<reduce::stripe_reducer> reducers(count);
+            for (k = 0; k < count; k++) {
+                reducers[k] = reduce::get_stripe_reducer(
+                    p_job->file_type,
+                    reduce::get_reduce_func(jobs[k].p_params->to_func),
+                    p_params->fast_math);
+            }
+
+            // Debug {{{
+            if (p_params->debug) {
+                // printf("\033[0;33mDebug {{{\n");
+
+                printf("\n");
+                printf("bin_width: %d\n", p_job->bin_width);
+                printf("bin_height: %d\n", p_job->bin_height);
+
+                printf("to_width: %d\n", p_job->to_width);
+                printf("to_height: %d\n", p_job->to_height);
+
+                if (box) {
+                    printf("factor_x: %d\n", factor_x);
+                    printf("factor_y: %d\n", factor_y);
+                } else {
+                    printf("filter: %s\n",
+                           reduce::get_resample_filter_name(p_params->to_filter)); // NOLINT
+                }
+
+                printf("p_job->file_type: %s\n",
+                       reduce::get_file_type_name(p_job->file_type));
+
+                if (reduce::is_complex_type(p_job->file_type)) {
+                    for (k = 0; k < count; k++) {
+                        printf("func: %s\n", jobs[k].p_params->to_func);
+                    }
+                    printf("simd: %s\n",
+                           simd::get_simd_name(simd::get_simd_level()));
+                }
+
+                // printf("Debug }}}\033[0m\n");
+            }
+            // Debug }}}
+
+            for (k = 0; k < count; k++) {
+                ddata[k] = new double[p_job->to_width*p_job->to_height]; // NOLINT
+            }
+
+            int result = 0;
+
+            if (!box) {
+                result = resample_file(filename_bin, p_job,
+                                       static_cast<char*>(data),
+                                       &reducers[0], count, ddata);
+                if (data) {
+                    free_binary_data(data, p_job);
+                }
+            } else if (stream) {
+                result = reduce_file_by_stripes(filename_bin, p_job,
+                                                factor_x, factor_y,
+                                                &reducers[0], count, ddata);
+            } else {
+                size_t stripe_size = static_cast<size_t>(p_job->bin_width)*
+                                     factor_y*
+                                     reduce::get_element_size(p_job->file_type); // NOLINT
+
+                // Output rows are independent, reduce them in bands
+                #pragma omp parallel for schedule(static)
+                for (j = 0; j < p_job->to_height; j++) {
+                    reduce_stripe_funcs(static_cast<char*>(data) + stripe_size*j, // NOLINT
+                                        p_job, factor_x, factor_y,
+                                        &reducers[0], count, ddata, j);
+                }
+
+                free_binary_data(data, p_job);
+            }
+
+            if (result != 0) {
+                for (k = 0; k < count; k++) {
+                    delete[] ddata[k];
+                    ddata[k] = NULL;
+                }
+                return 1;
+            }
+
+            for (k = 1; k < count; k++) {
+                const bin2gif_parameters *p_func_params = jobs[k].p_params;
+                jobs[k] = jobs[0];
+                jobs[k].p_params = p_func_params;
+            }
+
+            return 0;
+        }
+
+        /**
+        * Get reduced data of file by function of every job and its data
+        * range. With --cache reduced data of unchanged file is taken from
+        * cache, file is read only for functions missing in cache.
+        * @param ddata Reduced data of every job, free it by delete[]
+        * @return int 0 on success
+        */
+        int reduce_binary_file_funcs(char* filename_bin,
+                                     bin2gif_job *jobs, int count,
+                                     double **ddata,
+                                     double *mins, double *maxs) {
+            const bin2gif_parameters *p_params = jobs[0].p_params;
+
+            std::vector<bin2gif_job> missing_jobs;
+            std::vector<int> missing;
+            int i = 0, j = 0, k = 0;
+
+            for (k = 0; k < count; k++) {
+                ddata[k] = NULL;
+
+                if (p_params->use_cache) {
+                    ddata[k] = stats::load_cache(filename_bin, &jobs[k],
+                                                 &mins[k], &maxs[k]);
+
+                    if (p_params->debug) {
+                        printf("cache: %s\n", ddata[k] ? "hit" : "miss");
+                    }
+                }
+
+                if (!ddata[k]) {
+                    missing_jobs.push_back(jobs[k]);
+                    missing.push_back(k);
+                }
+            }
+
+            if (!missing.empty()) {
+                std::vector<double*> missing_ddata(missing.size(), NULL);
+
+                if (read_and_reduce_file(filename_bin, &missing_jobs[0],
+                                         missing.size(),
+                                         &missing_ddata[0]) != 0) {
+                    for (k = 0; k < count; k++) {
+                        delete[] ddata[k];
+                        ddata[k] = NULL;
+                    }
+                    return 1;
+                }
+
+                for (k = 0; k < static_cast<int>(missing.size()); k++) {
+                    int m = missing[k];
+
+                    jobs[m] = missing_jobs[k];
+                    ddata[m] = missing_ddata[k];
+
+                    // Cache keeps exact range, --range is found below
+                    find_min_max(ddata[m],
+                                 static_cast<off_t>(jobs[m].to_width)*
+                                     jobs[m].to_height,
+                                 &mins[m], &maxs[m]);
+
+                    if (p_params->use_cache &&
+                        stats::save_cache(filename_bin, &jobs[m], ddata[m],
+                                          mins[m], maxs[m]) != 0) {
+                        printf("Cannot write cache for %s.\n", filename_bin);
+                    }
+                }
+            }
+
+            // Percentiles of reduced data, cached or not; exact range
+            // is kept for not finite data
+            if (p_params->use_range) {
+                for (k = 0; k < count; k++) {
+                    off_t pixels = static_cast<off_t>(jobs[k].to_width)*
+                                   jobs[k].to_height;
+                    off_t finite = find_percentile_range(ddata[k], pixels,
+                                                         p_params->range_low,
+                                                         p_params->range_high,
+                                                         &mins[k], &maxs[k]);
+                    if (finite < pixels) {
+                        printf("%lld of %lld values are NaN or infinite.\n", // NOLINT
+                               static_cast<long long>(pixels - finite),
+                               static_cast<long long>(pixels));
+                    }
+                }
+            }
+
+            if (p_params->export_text) {
+                for (k = 0; k < count; k++) {
+                    const bin2gif_job *p_job = &jobs[k];
+
+                    for (j = 0; j < p_job->to_height; j++) {
+                        for (i = 0; i < p_job->to_width; i++) {
+                            printf("%d  %d  %lf\n", i, j, ddata[k][p_job->to_width*j+i]);
+                        }
+                    }
+                }
+            }
+
+            return 0;
+        }
 
-                    if (p_params->debug) {
-                        printf("sr: %lf\n", p_params->sr);
-                        printf("st: %lf\n", p_params->st);
-                    }
+        /**
+        * Get reduced data of file by function of job and its data range
+        * @return double* Reduced data, NULL on error
+        */
+        double* reduce_binary_file(char* filename_bin, bin2gif_job *p_job,
+                                   double *p_min, double *p_max) {
+            double *ddata = NULL;
 
-                    if (p_params->to_width < 0) {
-                        p_params->to_width = 2*static_cast<int>( p_params->sr / sqrt((grid_r[nr-1]-grid_r[nr-2])*(grid_r[1]-grid_r[0])) ) + 1; // NOLINT
-                    }
-                    if (p_params->to_height < 0) {
-                        p_params->to_height = 2*static_cast<int>( p_params->st / sqrt((grid_t[nt-1]-grid_t[nt-2])*(grid_t[static_cast<int>((nt-1)/2)-1]-grid_t[static_cast<int>((nt-1)/2)])) ) + 1; // NOLINT
-                    }
+            if (reduce_binary_file_funcs(filename_bin, p_job, 1, &ddata,
+                                         p_min, p_max) != 0) {
+                return NULL;
+            }
 
-                    // Debug {{{
-                    if (p_params->debug) {
-                        // printf("\033[0;33mDebug {{{\n");
+            return ddata;
+        }
 
-                        printf("In --axial-all\n");
-                        printf("to_width: %d\n", p_params->to_width);
-                        printf("to_height: %d\n", p_params->to_height);
-                        printf("sr: %lf\n", p_params->sr);
-                        printf("st: %lf\n", p_params->st);
+        /**
+        * Draw reduced data of job with its data range into image file
+        * @return int 0 on success
+        */
+        int render_job_to_gif(char* filename_image, const bin2gif_job *p_job,
+                              const double *ddata,
+                              double d_min, double d_max) {
+            const bin2gif_parameters *p_params = p_job->p_params;
 
-                        // printf("Debug }}}\033[0m\n");
-                    }
+            int i = 0, j = 0;
 
-                    if (p_params->file_type == t_complex_double) {
-                        data = new std::complex<double>[
-                                   p_params->to_width*p_params->to_height
-                               ];
-                    } else {
-                        data = new double[
-                                   p_params->to_width*p_params->to_height
-                               ];
-                    }
-                    if (!data) {
-                        printf("Cannot allocate memory for data.\n");
-                        delete[] grid_r;
-                        delete[] grid_t;
-                        delete[] axdata;
-                        return NULL;
-                    }
-                    data_cd = static_cast<std::complex<double>*>(data);
-                    data_d = static_cast<double*>(data);
+            get_color_range(p_params, &d_min, &d_max);
 
-                    // Convert axial to square
-                    int k_r = 0, k_t = 0;
-                    for (j = 0; j < p_params->to_height; j++) {
-                        for (i = 0; i < p_params->to_width/2; i++) {
-                            r = p_params->sr * 2 * static_cast<double>(i) / p_params->to_width; // NOLINT
-                            t = p_params->st * 2 * static_cast<double>(j - p_params->to_height/2) / p_params->to_height; // NOLINT
-
-                            if (r < grid_r[k_r]) {
-                                for (; k_r >= 0; k_r--) {
-                                    if (grid_r[k_r] <= r && r <= grid_r[k_r + 1]) { // NOLINT
-                                        break;
-                                    }
-                                }
-                            } else {
-                                for (; k_r < nr-1; k_r++) {
-                                    if (grid_r[k_r] <= r && r <= grid_r[k_r + 1]) { // NOLINT
-                                        break;
-                                    }
-                                }
-                            }
+            if (p_params->use_mathgl &&
+                (p_params->bin_axial || p_params->bin_axial_all)) {
+                mglData md_x, md_y, md_z;
 
-                            if (t < grid_t[k_t]) {
-                                for (; k_t >= 0; k_t--) {
-                                    if (grid_t[k_t] <= t && t <= grid_t[k_t + 1]) { // NOLINT
-                                        break;
-                                    }
-                                }
-                            } else {
-                                for (; k_t < nt-1; k_t++) {
-                                    if (grid_t[k_t] <= t && t <= grid_t[k_t + 1]) { // NOLINT
-                                        break;
-                                    }
-                                }
-                            }
+                // Debug {{{
+                if (p_params->debug) {
+                    // printf("\033[0;33mDebug {{{\n");
+                    printf("p_job->to_width: %d\n", p_job->to_width);
+                    printf("p_job->to_height: %d\n", p_job->to_height);
+                    printf("p_job->sr: %lf\n", p_job->sr);
+                    printf("p_job->st: %lf\n", p_job->st);
+                    // printf("Debug }}}\033[0m\n");
+                }
+                // Debug }}}
 
-                            if (p_params->file_type == t_complex_double) {
-                                data_cd[p_params->to_width*j + (p_params->to_width/2 + i)] =                                                                  // NOLINT
-                                    interpolate2D< std::complex<double> >(grid_r[k_r], grid_r[k_r+1], grid_t[k_t], grid_t[k_t+1],                            // NOLINT
-                                                                           axdata_cd[nr*k_t + k_r], axdata_cd[nr*(k_t+1) + k_r],                              // NOLINT
-                                                                           axdata_cd[nr*k_t + (k_r+1)], axdata_cd[nr*(k_t+1) + (k_r+1)], r, t);               // NOLINT
-                                data_cd[p_params->to_width*j + (p_params->to_width/2 - 1 - i)] = data_cd[p_params->to_width*j + (p_params->to_width/2 + i)];  // NOLINT
-                            } else {
-                                data_d[p_params->to_width*j + (p_params->to_width/2 + i)] =                                                                   // NOLINT
-                                    interpolate2D< double >(grid_r[k_r], grid_r[k_r+1], grid_t[k_t], grid_t[k_t+1],                                          // NOLINT
-                                                             axdata_d[nr*k_t + k_r], axdata_d[nr*(k_t+1) + k_r],                                            // NOLINT
-                                                             axdata_d[nr*k_t + (k_r+1)], axdata_d[nr*(k_t+1) + (k_r+1)], r, t);                             // NOLINT
-                                data_d[p_params->to_width*j + (p_params->to_width/2 - 1 - i)] = data_d[p_params->to_width*j + (p_params->to_width/2 + i)];   // NOLINT
-                            }
+                md_x.Create(p_job->to_width, p_job->to_height);
+                md_y.Create(p_job->to_width, p_job->to_height);
+                md_z.Create(p_job->to_width, p_job->to_height);
+
+                if (p_params->bin_axial_all) {
+                    for (j = 0; j < p_job->to_height; j++) { // t
+                        for (i = 0; i < p_job->to_width; i++) { // r
+                            md_x.a[p_job->to_width*j+i] = -p_job->sr +
+                                  2.0 * p_job->sr *
+                                      static_cast<double>(i)/p_job->to_width;
+                            md_y.a[p_job->to_width*j+i] = -p_job->st +
+                                  2.0 * p_job->st *
+                                      static_cast<double>(j)/p_job->to_height;
+                            md_z.a[p_job->to_width*j+i] =
+                                                  ddata[p_job->to_width*j+i];
+                            md_y.a[p_job->to_width*j+i] *= -1.0;
+                        }
+                    }
+                } else {
+                    for (j = 0; j < p_job->to_height; j++) { // t
+                        for (i = 0; i < p_job->to_width; i++) { // r
+                            md_x.a[p_job->to_width*j+i] = -p_job->sr +
+                                  2.0 * p_job->sr *
+                                      static_cast<double>(i)/p_job->to_width;
+                            md_y.a[p_job->to_width*j+i] = -p_job->sr +
+                                  2.0 * p_job->sr *
+                                      static_cast<double>(j)/p_job->to_height;
+                            md_z.a[p_job->to_width*j+i] =
+                                                  ddata[p_job->to_width*j+i];
                         }
                     }
                 }
 
-                // Temp hack
-                p_params->bin_width = p_params->to_width;
-                p_params->bin_height = p_params->to_height;
-
-                delete[] axdata;
-            } else {  // Standart square matrix
-                // Determine file type and image size {{{
-                file_size = fs::file_size(filename)
-                            - p_params->bin_header
-                            - p_params->bin_footer;
-                if (file_size <= 0) {
-                    printf("Cannot determine file size.\n");
-                    return NULL;
-                }
-                if (p_params->autodetect_bin_sizes) {
-                    elements_in_file = file_size / sizeof(std::complex<double>);
-                    n = static_cast<off_t>(sqrt(static_cast<double>(elements_in_file))); // NOLINT
-                    if (elements_in_file != n*n) {
-                        p_params->file_type = t_double;
-                        elements_in_file = file_size / sizeof(double);
-                        n = static_cast<off_t>(sqrt(static_cast<double>(elements_in_file))); // NOLINT
+                // MathGL graphs are not known to be thread safe
+                #pragma omp critical(mathgl)
+                {
+                    mglGraphZB mgr(2048, 1024);
+                    mgr.SetCut(false);
+                    //mgr.SetCut(true);
+
+                    // TODO: Fix d_min
+                    d_max = static_cast<int>(d_max + 0.5);
+                    d_min = d_max/10.;
+
+                    //mgr.Light(true);
+                    //mgr.Light(0, mglPoint(0, 0, 1));
+                    //mgr.Colorbar();
+                    mgr.SetTicks('x', 1, 1, 0);
+                    mgr.SetTicks('y', 1, 1, 0);
+
+                    mgr.SubPlot(2, 1, 0);
+                    mgr.Rotate(0, 90);
+                    mgr.SetRanges(-2, 2, -2, 2, d_min, d_max);
+                    mgr.AdjustTicks();
+                    mgr.Axis();
+                    if (p_params->bin_axial_all) {
+                        mgr.Label('x', "r", 0);
+                        mgr.Label('y', "t", 0);
+                    } else {
+                        mgr.Label('y', "r", 0);
                     }
+                    mgr.Surf(md_x, md_y, md_z);
 
-                    p_params->bin_width = n;
-                    p_params->bin_height = n;
-                } else {
-                    elements_in_file = p_params->bin_width*p_params->bin_height;
-                    n = static_cast<off_t>(sqrt(static_cast<double>(elements_in_file))); // NOLINT
-                    if (elements_in_file*sizeof(double) == file_size) {
-                        p_params->file_type = t_double;
-                    } else if (elements_in_file*sizeof(std::complex<double>) == file_size) {
-                        p_params->file_type = t_complex_double;
+                    mgr.SubPlot(2, 1, 1);
+                    if (p_params->bin_axial_all) {
+                        mgr.Rotate(50 /*tilt*/, 70 /*rotate*/);
+                        mgr.Aspect(0.5, 1.0, 0.5);
+                        mgr.SetRanges(-1, 1, -2, 2, d_min, d_max);
                     } else {
-                        printf("Cannot determine file type.\n");
-                        return NULL;
+                        mgr.Rotate(60 /*tilt*/, -40 /*rotate*/);
+                        mgr.Aspect(1.0, 1.0, 0.5);
+                        mgr.SetRanges(-2, 2, -2, 2, d_min, d_max);
+                    }
+                    mgr.SetFunc(0, 0, "lg(z)");
+                    mgr.SetTicks('z', 0);
+                    mgr.AdjustTicks("z");
+                    mgr.Axis();
+                    if (p_params->bin_axial_all) {
+                        mgr.Label('x', "r", 0);
+                        mgr.Label('y', "t", 0);
+                    } else {
+                        mgr.Label('x', "r", 0);
+                        mgr.Label('y', "r", 0);
                     }
+                    mgr.Surf(md_x, md_y, md_z);
+                    //mgr.ContD(0, md_x, md_y, md_z, "", 1);
 
-                    p_params->bin_width = n;
-                    p_params->bin_height = n;
+                    mgr.WritePNG(filename_image);
                 }
+            } else if (write_gif_image(filename_image, ddata, p_job,
+                                       d_min, d_max) != 0) {
+                return 1;
+            }
 
-                if (p_params->bin_width < p_params->to_width) {
-                    p_params->to_width = p_params->bin_width;
-                }
+            return 0;
+        }
 
-                if (p_params->bin_height < p_params->to_height) {
-                    p_params->to_height = p_params->bin_height;
-                }
-                // }}}
+        /**
+        * Reduce pyramid level 2x: every pixel is average of 2x2 pixels,
+        * last row and column of odd size are averaged with themselves
+        */
+        void reduce_pyramid_level(const double *level, int width, int height,
+                                  double *next) {
+            int next_width = (width + 1)/2, next_height = (height + 1)/2;
+            int i = 0, j = 0;
 
-                off_t bin_count = static_cast<off_t>(p_params->bin_width)*p_params->bin_height; // NOLINT
+            #pragma omp parallel for private(i) schedule(static)
+            for (j = 0; j < next_height; j++) {
+                const double *row0 = level + static_cast<off_t>(width)*2*j;
+                const double *row1 = (2*j + 1 < height) ? row0 + width : row0;
+                double *out = next + static_cast<off_t>(next_width)*j;
 
-                // No resize if --resize not specified {{{
-                if (p_params->to_width < 0) {
-                    p_params->to_width = p_params->bin_width;
+                for (i = 0; i < next_width; i++) {
+                    int i1 = (2*i + 1 < width) ? 2*i + 1 : 2*i;
+                    out[i] = (row0[2*i] + row0[i1] + row1[2*i] + row1[i1])/4;
                 }
+            }
+        }
 
-                if (p_params->to_height < 0) {
-                    p_params->to_height = p_params->bin_height;
+        /**
+        * Write reduced data as deep zoom image: 256x256 GIF tiles of
+        * every 2x level in <name>_files/<level>/<column>_<row>.gif and
+        * descriptor <name>.dzi, written last. Each level is reduced from
+        * previous one; all tiles share data range and palette of full
+        * image, so they match at every zoom.
+        * @return int 0 on success
+        */
+        int write_pyramid(char* filename_dzi, const bin2gif_job *p_job,
+                          const double *ddata, double d_min, double d_max) {
+            const bin2gif_parameters *p_params = p_job->p_params;
+            const int tile_size = 256;
+
+            int width = p_job->to_width, height = p_job->to_height;
+            int i = 0, j = 0, t = 0, level = 0, max_level = 0, failed = 0;
+            char dirname[1024], filename_tile[1024];
+
+            get_color_range(p_params, &d_min, &d_max);
+
+            // Tiles are small, so they are drawn on all threads at once,
+            // every one as plain single-threaded image
+            bin2gif_parameters tile_params = *p_params;
+            tile_params.to_reflect = false;
+            tile_params.gif_tiles = 1;
+
+            const double *data = ddata;
+            double *level_data = NULL;
+
+            if (p_params->to_reflect) {
+                level_data = new double[static_cast<size_t>(width)*height];
+
+                #pragma omp parallel for private(i) schedule(static)
+                for (j = 0; j < width; j++) {
+                    for (i = 0; i < height; i++) {
+                        level_data[static_cast<off_t>(height)*j + i] =
+                            ddata[static_cast<off_t>(width)*i + j];
+                    }
                 }
 
-                if (p_params->file_type == t_complex_double) {
-                    data = new std::complex<double>[bin_count];
-                } else {
-                    data = new double[bin_count];
-                }
-                if (!data) {
-                    printf("Cannot allocate memory for data.\n");
-                    return NULL;
-                }
-                data_cd = static_cast<std::complex<double>*>(data);
-                data_d = static_cast<double*>(data);
+                std::swap(width, height);
+                data = level_data;
+            }
 
-                fp = fopen(filename, "r");
+            // Level 0 is 1x1 pixel, full size is the last one
+            while ((1 << max_level) < std::max(width, height)) {
+                max_level++;
+            }
 
-                if (!fp) {
-                    printf("Cannot open input file %s  for reading.\n",
-                           filename);
-                    delete[] data;
-                    return NULL;
-                }
+            std::string files_dir(filename_dzi, strlen(filename_dzi) - 4);
+            files_dir += "_files";
+            if (fs::create_dir(const_cast<char*>(files_dir.c_str())) != 0) {
+                printf("Cannot create directory %s.\n", files_dir.c_str());
+                delete[] level_data;
+                return 1;
+            }
 
-                fseek(fp, p_params->bin_header, SEEK_SET);
+            int level_width = width, level_height = height;
 
-                if (p_params->file_type == t_complex_double) {
-                    elements_in_file = fread(data,
-                                             sizeof(std::complex<double>),
-                                             bin_count, fp);
-                } else {
-                    elements_in_file = fread(data, sizeof(double),
-                                             bin_count, fp);
+            for (level = max_level; level >= 0 && failed == 0; level--) {
+                snprintf(dirname, sizeof(dirname), "%s/%d",
+                         files_dir.c_str(), level);
+                if (fs::create_dir(dirname) != 0) {
+                    printf("Cannot create directory %s.\n", dirname);
+                    failed++;
+                    break;
                 }
 
-                if (elements_in_file != bin_count) {
-                    printf("Error: Bad file format or corrupted file\n");
-                    printf("Only %ld elements of %d readed.\n",
-                           elements_in_file, bin_count);
-                    delete[] data;
-                    fclose(fp);
-                    return NULL;
+                int tiles_x = (level_width + tile_size - 1)/tile_size;
+                int tiles_y = (level_height + tile_size - 1)/tile_size;
+
+                #pragma omp parallel for private(j, filename_tile) schedule(dynamic, 1) // NOLINT
+                for (t = 0; t < tiles_x*tiles_y; t++) {
+                    int x = (t % tiles_x)*tile_size;
+                    int y = (t / tiles_x)*tile_size;
+
+                    bin2gif_job tile_job = *p_job;
+                    tile_job.p_params = &tile_params;
+                    tile_job.to_width = std::min(tile_size, level_width - x);
+                    tile_job.to_height = std::min(tile_size, level_height - y);
+
+                    std::vector<double> tile(static_cast<size_t>(tile_job.to_width)* // NOLINT
+                                             tile_job.to_height);
+                    for (j = 0; j < tile_job.to_height; j++) {
+                        memcpy(&tile[static_cast<size_t>(tile_job.to_width)*j], // NOLINT
+                               data + static_cast<off_t>(level_width)*(y + j) + x, // NOLINT
+                               sizeof(double)*tile_job.to_width);
+                    }
+
+                    snprintf(filename_tile, sizeof(filename_tile),
+                             "%s/%d_%d.gif", dirname,
+                             t % tiles_x, t / tiles_x);
+                    if (write_gif_image(filename_tile, &tile[0], &tile_job,
+                                        d_min, d_max) != 0) {
+                        #pragma omp atomic
+                        failed++;
+                    }
                 }
 
-                fclose(fp);
+                if (level > 0) {
+                    double *next = new double[static_cast<size_t>((level_width + 1)/2)* // NOLINT
+                                              ((level_height + 1)/2)];
+                    reduce_pyramid_level(data, level_width, level_height,
+                                         next);
+
+                    delete[] level_data;
+                    level_data = next;
+                    data = next;
+                    level_width = (level_width + 1)/2;
+                    level_height = (level_height + 1)/2;
+                }
             }
 
-            return data;
-        }
+            delete[] level_data;
 
-        int convert_binary_file_to_gif(char* filename_bin, char* filename_image,
-                                       bin2gif_parameters *p_params) {
-            gdImagePtr im;
+            if (failed) {
+                return 1;
+            }
 
-            int i = 0, j = 0, ii = 0, jj = 0, kk = 0;
-            int factor_x = 1, factor_y = 1;
+            FILE *fp = fopen(filename_dzi, "w");
+            if (!fp) {
+                printf("Cannot open output file %s for writing.\n",
+                       filename_dzi);
+                return 1;
+            }
 
-            double (*func)(const std::complex<double>&) = std::abs;
+            fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+            fprintf(fp, "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\"\n"); // NOLINT
+            fprintf(fp, "       TileSize=\"%d\" Overlap=\"0\" Format=\"gif\">\n", // NOLINT
+                    tile_size);
+            fprintf(fp, "    <Size Width=\"%d\" Height=\"%d\"/>\n",
+                    width, height);
+            fprintf(fp, "</Image>\n");
 
-            if (       strcmp(p_params->to_func, "amp") == 0) { // NOLINT
-                func = std::abs;
-            } else if (strcmp(p_params->to_func, "norm") == 0) {
-                func = std::norm;
-            } else if (strcmp(p_params->to_func, "real") == 0) {
-                func = sns::visual::real;
-            } else if (strcmp(p_params->to_func, "imag") == 0) {
-                func = sns::visual::imag;
-            } else if (strcmp(p_params->to_func, "arg") == 0) {
-                func = std::arg;
+            if (fclose(fp) != 0) {
+                printf("Cannot write output file %s.\n", filename_dzi);
+                return 1;
             }
 
-            double d_value = 0;
-
-            // Read data from file and convert to square matrix
-            void *data = get_data_from_binary_file(filename_bin, p_params);
-            std::complex<double>* data_cd = static_cast<std::complex<double>*>(data); // NOLINT
-            double* data_d = static_cast<double*>(data);
+            return 0;
+        }
 
-            factor_x = p_params->bin_width/p_params->to_width;
-            factor_y = p_params->bin_height/p_params->to_height;
+        /**
+        * Reduce binary file as for conversion and find its data range,
+        * range of all selected --axial layers, read from one descriptor
+        * @return int Zero on success
+        */
+        int find_file_range(char* filename_bin,
+                            const bin2gif_parameters *p_params,
+                            double *p_min, double *p_max) {
+            bin2gif_job job;
+            bin2gif_job *p_job = &job;
+            int layer = p_params->layer_first, fd = -1, result = 0;
+            bool first = true;
+
+            if (layer >= 0) {
+                fd = open(filename_bin, O_RDONLY);
+                if (fd < 0) {
+                    printf("Cannot open input file %s  for reading.\n",
+                           filename_bin);
+                    return 1;
+                }
+            }
 
-            // Debug {{{
-            if (p_params->debug) {
-                // printf("\033[0;33mDebug {{{\n");
+            do {
+                double d_min = 0, d_max = 0;
 
-                printf("\n");
-                printf("bin_width: %d\n", p_params->bin_width);
-                printf("bin_height: %d\n", p_params->bin_height);
+                init_job(p_job, p_params);
+                p_job->layer = layer;
+                p_job->axial_fd = fd;
 
-                printf("to_width: %d\n", p_params->to_width);
-                printf("to_height: %d\n", p_params->to_height);
+                double *ddata = reduce_binary_file(filename_bin, p_job,
+                                                   &d_min, &d_max);
+                if (!ddata) {
+                    result = 1;
+                    break;
+                }
 
-                printf("factor_x: %d\n", factor_x);
-                printf("factor_y: %d\n", factor_y);
+                delete[] ddata;
 
-                if (p_params->file_type == t_complex_double) {
-                    printf("p_params->file_type: std::complex<double>\n");
-                } else {
-                    printf("p_params->file_type: double\n");
+                if (first || d_min < *p_min) {
+                    *p_min = d_min;
                 }
-
-                if (p_params->file_type == t_complex_double) {
-                    printf("func: %s\n", p_params->to_func);
+                if (first || *p_max < d_max) {
+                    *p_max = d_max;
                 }
+                first = false;
 
-                // printf("Debug }}}\033[0m\n");
-            }
-            // Debug }}}
-
-            double *ddata = new double[p_params->to_width*p_params->to_height]; // NOLINT
+                layer += p_params->layer_step;
+            } while (layer >= 0 && layer <= p_params->layer_last);
 
-            if (!ddata) {
-                printf("Cannot allocate memory for data.\n");
-                delete[] data;
-                return 1;
+            if (fd >= 0) {
+                close(fd);
             }
 
-            if (!p_params->to_reflect) {
-                im = gdImageCreateTrueColor(p_params->to_width,
-                                            p_params->to_height);
-            } else {
-                im = gdImageCreateTrueColor(p_params->to_height,
-                                            p_params->to_width);
+            return result;
+        }
+
+        /**
+        * Convert binary file into image of every function and --axial
+        * layer. File is read once per layer and reduced by all functions
+        * at once; --axial layers are read by offset from one descriptor.
+        * With --pyramid every image is deep zoom descriptor with tiles.
+        * @param params_funcs Parameters of every function, differ by to_func
+        * @param filenames_image Image of layer l and function f at
+        *                        l*funcs_count + f, NULL if it is not needed
+        * @param results Zero for every image written, 1 on its error
+        * @return int Number of failed images
+        */
+        int convert_binary_file_to_gifs(char* filename_bin,
+                                        const bin2gif_parameters *params_funcs, // NOLINT
+                                        int funcs_count,
+                                        const int *layers, int layers_count,
+                                        char** filenames_image, int *results) {
+            int k = 0, l = 0, f = 0, failed = 0;
+            int fd = -1;
+
+            for (k = 0; k < funcs_count*layers_count; k++) {
+                results[k] = 1;
             }
 
-            if (!im) {
-                printf("Cannot create GD image.\n");
-                delete[] data;
-                delete[] ddata;
-                return 1;
+            if (layers[0] >= 0) {
+                fd = open(filename_bin, O_RDONLY);
+                if (fd < 0) {
+                    printf("Cannot open input file %s  for reading.\n",
+                           filename_bin);
+                    return funcs_count*layers_count;
+                }
             }
 
-            for (j = 0; j < p_params->to_height; j++) {
-                for (i = 0; i < p_params->to_width; i++) {
-                    d_value = 0;
+            for (l = 0; l < layers_count; l++) {
+                std::vector<bin2gif_job> jobs;
+                std::vector<int> outputs;
 
-                    for (jj = 0; jj < factor_y; jj++) {
-                        for (ii = 0; ii < factor_x; ii++) {
-                            kk = p_params->bin_width*(factor_y*j + jj) +
-                                                    (factor_x*i + ii);
-                            if (p_params->file_type == t_complex_double) {
-                                d_value += func(data_cd[kk]);
-                            } else {
-                                d_value += data_d[kk];
-                            }
-                        }
+                for (f = 0; f < funcs_count; f++) {
+                    if (!filenames_image[l*funcs_count + f]) {
+                        continue;
                     }
 
-                    ddata[p_params->to_width*j+i] = d_value/factor_x/factor_y;
+                    bin2gif_job job;
+                    init_job(&job, &params_funcs[f]);
+                    job.layer = layers[l];
+                    job.axial_fd = fd;
+
+                    jobs.push_back(job);
+                    outputs.push_back(l*funcs_count + f);
+                }
+
+                if (jobs.empty()) {
+                    continue;
                 }
-            }
 
-            delete[] data;
+                std::vector<double*> ddata(jobs.size(), NULL);
+                std::vector<double> mins(jobs.size()), maxs(jobs.size());
 
-            if (p_params->export_text) {
-                for (j = 0; j < p_params->to_height; j++) {
-                    for (i = 0; i < p_params->to_width; i++) {
-                        printf("%d  %d  %lf\n", i, j, ddata[p_params->to_width*j+i]);
+                if (reduce_binary_file_funcs(filename_bin, &jobs[0],
+                                             jobs.size(), &ddata[0],
+                                             &mins[0], &maxs[0]) != 0) {
+                    failed += jobs.size();
+                    continue;
+                }
+
+                for (k = 0; k < static_cast<int>(jobs.size()); k++) {
+                    if (jobs[k].p_params->pyramid) {
+                        results[outputs[k]] = write_pyramid(
+                            filenames_image[outputs[k]], &jobs[k], ddata[k],
+                            mins[k], maxs[k]);
+                    } else {
+                        results[outputs[k]] = render_job_to_gif(
+                            filenames_image[outputs[k]], &jobs[k], ddata[k],
+                            mins[k], maxs[k]);
+                    }
+                    if (results[outputs[k]] != 0) {
+                        failed++;
                     }
+
+                    delete[] ddata[k];
                 }
             }
 
-            double d_min, d_max;
+            if (fd >= 0) {
+                close(fd);
+            }
 
-            d_min = *std::min_element(ddata,
-                                ddata + p_params->to_width*p_params->to_height);
-            d_max = *std::max_element(ddata,
-                                ddata + p_params->to_width*p_params->to_height);
+            return failed;
+        }
 
-            if (strcmp(p_params->to_func, "arg") == 0) {
-                if (p_params->debug) {
-                    // printf("\033[0;33mDebug {{{\n");
-                    printf("d_min: %lf\n", d_min);
-                    printf("d_max: %lf\n", d_max);
-                    // printf("Debug }}}\033[0m\n");
-                }
+        /**
+        * Find bounding rectangle of pixels that differ between frames
+        * @return bool False if frames are the same
+        */
+        bool find_changed_rect(const unsigned char *previous,
+                               const unsigned char *current,
+                               int width, int height,
+                               int *p_left, int *p_top,
+                               int *p_width, int *p_height) {
+            int top = 0, bottom = height - 1, left = width, right = -1;
+            int i = 0, j = 0;
 
-                d_min = -M_PI;
-                d_max = M_PI;
-            } else if ((p_params->to_amp > 0) &&
-                        !(p_params->to_use_min ||
-                          p_params->to_use_max ||
-                          p_params->to_amp_e)
-                       ) {
-                d_min = ( (strcmp(p_params->to_func, "norm") == 0) ||
-                          (strcmp(p_params->to_func, "abs") == 0) ) ?
-                          0 : -p_params->to_amp;
-                d_max = p_params->to_amp;
-            } else if (p_params->to_amp_e) {
-                d_min = d_min/M_El;
-                d_max = d_max/M_El;
+            while (top < height &&
+                   memcmp(previous + static_cast<size_t>(width)*top,
+                          current + static_cast<size_t>(width)*top,
+                          width) == 0) {
+                top++;
             }
 
-            if (p_params->to_use_min) {
-                d_min = p_params->to_min;
+            if (top == height) {
+                return false;
             }
 
-            if (p_params->to_use_max) {
-                d_max = p_params->to_max;
+            while (memcmp(previous + static_cast<size_t>(width)*bottom,
+                          current + static_cast<size_t>(width)*bottom,
+                          width) == 0) {
+                bottom--;
             }
 
-            // Debug {{{
-            if (p_params->debug) {
-                // printf("\033[0;33mDebug {{{\n");
-                printf("d_min: %lf\n", d_min);
-                printf("d_max: %lf\n", d_max);
-                // printf("Debug }}}\033[0m\n");
+            for (j = top; j <= bottom; j++) {
+                const unsigned char *a = previous + static_cast<size_t>(width)*j; // NOLINT
+                const unsigned char *b = current + static_cast<size_t>(width)*j; // NOLINT
+
+                for (i = 0; i < left && a[i] == b[i]; i++) {}
+                left = std::min(left, i);
+
+                for (i = width - 1; i > right && a[i] == b[i]; i--) {}
+                right = std::max(right, i);
             }
-            // Debug }}}
 
-            if (p_params->use_mathgl &&
-                (p_params->bin_axial || p_params->bin_axial_all)) {
-                mglData md_x, md_y, md_z;
+            *p_left = left;
+            *p_top = top;
+            *p_width = right - left + 1;
+            *p_height = bottom - top + 1;
 
-                // Debug {{{
-                if (p_params->debug) {
-                    // printf("\033[0;33mDebug {{{\n");
-                    printf("p_params->to_width: %d\n", p_params->to_width);
-                    printf("p_params->to_height: %d\n", p_params->to_height);
-                    printf("p_params->sr: %lf\n", p_params->sr);
-                    printf("p_params->st: %lf\n", p_params->st);
-                    // printf("Debug }}}\033[0m\n");
-                }
-                // Debug }}}
+            return true;
+        }
 
-                md_x.Create(p_params->to_width, p_params->to_height);
-                md_y.Create(p_params->to_width, p_params->to_height);
-                md_z.Create(p_params->to_width, p_params->to_height);
+        /**
+        * Convert files into frames of one animated GIF with global palette.
+        * Every file is read once; first frame is written in full, later
+        * ones only in rectangle changed from previous frame, so only two
+        * indexed frames are held.
+        * @return int Zero on success
+        */
+        int convert_binary_files_to_animated_gif(char** filenames_bin,
+                                                 int count,
+                                                 char* filename_image,
+                                                 const bin2gif_parameters *p_params) { // NOLINT
+            bin2gif_job job;
+            bin2gif_job *p_job = &job;
+
+            gif::gif_writer writer;
+            bool writer_open = false;
+            unsigned char *frames[2] = {NULL, NULL};
+            int width = 0, height = 0;
+            int i = 0, j = 0, k = 0;
+            int result = 0;
+
+            // GIF color table is the palette itself
+            int colors[256];
+            for (i = 0; i < 256; i++) {
+                colors[i] = i;
+            }
 
-                if (p_params->bin_axial_all) {
-                    for (j = 0; j < p_params->to_height; j++) { // t
-                        for (i = 0; i < p_params->to_width; i++) { // r
-                            md_x.a[p_params->to_width*j+i] = -p_params->sr +
-                                  2.0 * p_params->sr *
-                                      static_cast<double>(i)/p_params->to_width;
-                            md_y.a[p_params->to_width*j+i] = -p_params->st +
-                                  2.0 * p_params->st *
-                                      static_cast<double>(j)/p_params->to_height;
-                            md_z.a[p_params->to_width*j+i] =
-                                                  ddata[p_params->to_width*j+i];
-                            md_y.a[p_params->to_width*j+i] *= -1.0;
-                        }
-                    }
-                } else {
-                    for (j = 0; j < p_params->to_height; j++) { // t
-                        for (i = 0; i < p_params->to_width; i++) { // r
-                            md_x.a[p_params->to_width*j+i] = -p_params->sr +
-                                  2.0 * p_params->sr *
-                                      static_cast<double>(i)/p_params->to_width;
-                            md_y.a[p_params->to_width*j+i] = -p_params->sr +
-                                  2.0 * p_params->sr *
-                                      static_cast<double>(j)/p_params->to_height;
-                            md_z.a[p_params->to_width*j+i] =
-                                                  ddata[p_params->to_width*j+i];
-                        }
-                    }
-                }
+            for (k = 0; k < count; k++) {
+                printf("File %s:\n", filenames_bin[k]);
+
+                init_job(p_job, p_params);
 
-                mglGraphZB mgr(2048, 1024);
-                mgr.SetCut(false);
-                //mgr.SetCut(true);
+                double d_min = 0, d_max = 0;
+                double *ddata = reduce_binary_file(filenames_bin[k], p_job,
+                                                   &d_min, &d_max);
+                if (!ddata) {
+                    result = 1;
+                    break;
+                }
 
-                // TODO: Fix d_min
-                d_max = static_cast<int>(d_max + 0.5);
-                d_min = d_max/10.;
+                get_color_range(p_params, &d_min, &d_max);
 
-                //mgr.Light(true);
-                //mgr.Light(0, mglPoint(0, 0, 1));
-                //mgr.Colorbar();
-                mgr.SetTicks('x', 1, 1, 0);
-                mgr.SetTicks('y', 1, 1, 0);
+                color_mapping mapping;
+                init_color_mapping(p_params, d_min, d_max, colors, &mapping);
 
-                mgr.SubPlot(2, 1, 0);
-                mgr.Rotate(0, 90);
-                mgr.SetRanges(-2, 2, -2, 2, d_min, d_max);
-                mgr.AdjustTicks();
-                mgr.Axis();
-                if (p_params->bin_axial_all) {
-                    mgr.Label('x', "r", 0);
-                    mgr.Label('y', "t", 0);
-                } else {
-                    mgr.Label('y', "r", 0);
+                int frame_width = p_job->to_width;
+                int frame_height = p_job->to_height;
+                if (p_params->to_reflect) {
+                    std::swap(frame_width, frame_height);
                 }
-                mgr.Surf(md_x, md_y, md_z);
 
-                mgr.SubPlot(2, 1, 1);
-                if (p_params->bin_axial_all) {
-                    mgr.Rotate(50 /*tilt*/, 70 /*rotate*/);
-                    mgr.Aspect(0.5, 1.0, 0.5);
-                    mgr.SetRanges(-1, 1, -2, 2, d_min, d_max);
-                } else {
-                    mgr.Rotate(60 /*tilt*/, -40 /*rotate*/);
-                    mgr.Aspect(1.0, 1.0, 0.5);
-                    mgr.SetRanges(-2, 2, -2, 2, d_min, d_max);
+                if (k == 0) {
+                    width = frame_width;
+                    height = frame_height;
+
+                    if (gif::open_gif(&writer, filename_image, width, height,
+                                      &p_params->palette) != 0) {
+                        printf("Cannot open output file %s for writing.\n",
+                               filename_image);
+                        delete[] ddata;
+                        result = 1;
+                        break;
+                    }
+                    writer_open = true;
+
+                    gif::write_loop(&writer);
+
+                    frames[0] = new unsigned char[static_cast<size_t>(width)*height]; // NOLINT
+                    frames[1] = new unsigned char[static_cast<size_t>(width)*height]; // NOLINT
+                } else if (frame_width != width || frame_height != height) {
+                    printf("Frame size %dx%d differs from first frame size %dx%d.\n", // NOLINT
+                           frame_width, frame_height, width, height);
+                    delete[] ddata;
+                    result = 1;
+                    break;
                 }
-                mgr.SetFunc(0, 0, "lg(z)");
-                mgr.SetTicks('z', 0);
-                mgr.AdjustTicks("z");
-                mgr.Axis();
-                if (p_params->bin_axial_all) {
-                    mgr.Label('x', "r", 0);
-                    mgr.Label('y', "t", 0);
-                } else {
-                    mgr.Label('x', "r", 0);
-                    mgr.Label('y', "r", 0);
-                }
-                mgr.Surf(md_x, md_y, md_z);
-                //mgr.ContD(0, md_x, md_y, md_z, "", 1);
-
-                mgr.WritePNG(filename_image);
-            } else { // Use GD for render plain image
-                int c_color;
-
-                for (j = 0; j < p_params->to_height; j++) {
-                    for (i = 0; i < p_params->to_width; i++) {
-                        c_color = static_cast<int>(255*(ddata[p_params->to_width*j+i]-d_min)/(d_max-d_min)); // NOLINT
-                        c_color = (c_color > 255) ? 255
-                                                  : ((c_color < 0) ? 0
-                                                                   : c_color);
-                        c_color = gdImageColorAllocate(im, palette[c_color][0],
-                                                           palette[c_color][1],
-                                                           palette[c_color][2]);
-
-                        if (!p_params->to_reflect) {
-                            gdImageSetPixel(im, i, j, c_color);
-                        } else {
-                            gdImageSetPixel(im, j, i, c_color);
-                        }
+
+                unsigned char *current = frames[k % 2];
+                unsigned char *previous = frames[(k + 1) % 2];
+
+                #pragma omp parallel private(j)
+                {
+                    double *column = new double[width];
+
+                    #pragma omp for schedule(static)
+                    for (j = 0; j < height; j++) {
+                        colormap_image_row(ddata, p_job, j, &mapping,
+                                           column,
+                                           current + static_cast<size_t>(width)*j); // NOLINT
                     }
+
+                    delete[] column;
                 }
 
                 delete[] ddata;
 
-                FILE *fp = fopen(filename_image, "wb");
+                int left = 0, top = 0;
+                int rect_width = width, rect_height = height;
+                if (k > 0 &&
+                    !find_changed_rect(previous, current, width, height,
+                                       &left, &top,
+                                       &rect_width, &rect_height)) {
+                    // Same frame, but GIF image can't be empty
+                    rect_width = 1;
+                    rect_height = 1;
+                }
 
-                if (!fp) {
-                    printf("Cannot open output file %s for writing.\n",
-                           filename_image);
-                    gdImageDestroy(im);
-                    return 1;
+                if (p_params->debug) {
+                    printf("frame rect: %dx%d+%d+%d\n",
+                           rect_width, rect_height, left, top);
+                }
+
+                gif::write_frame_control(&writer, p_params->frame_delay);
+                gif::begin_image(&writer, left, top, rect_width, rect_height);
+                for (j = top; j < top + rect_height; j++) {
+                    gif::write_pixels(&writer,
+                                      current + static_cast<size_t>(width)*j + left, // NOLINT
+                                      rect_width);
                 }
+                gif::end_image(&writer);
+            }
 
-                gdImageGif(im, fp);
+            delete[] frames[0];
+            delete[] frames[1];
 
-                fclose(fp);
-                gdImageDestroy(im);
+            if (writer_open) {
+                if (gif::close_gif(&writer) != 0) {
+                    printf("Cannot write output file %s.\n", filename_image);
+                    result = 1;
+                }
+
+                // Don't leave incomplete animation
+                if (result != 0) {
+                    unlink(filename_image);
+                }
             }
 
-            return 0;
+            return result;
         }
     }
 }
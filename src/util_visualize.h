@@ -7,22 +7,39 @@ See license text in LICENSE file
 #ifndef SRC_UTIL_VISUALIZE_H_
 #define SRC_UTIL_VISUALIZE_H_
 //---------------------------------------------------------------------------
+#ifdef BIN2GIF_USE_GD
 #include <gd.h>
+#endif
 #include <mgl/mgl_zb.h>
 //---------------------------------------------------------------------------
+#include <cmath>
 #include <complex>
 #include <cstring>
 #include <cstdlib>
 #include <algorithm>
-#include <list>
+#include <map>
+#include <string>
+#include <vector>
 //---------------------------------------------------------------------------
 #include "./parameters.h"
 //---------------------------------------------------------------------------
 namespace sns {
     namespace visual {
-        void init_color_palette(char* filename);
-        int convert_binary_file_to_gif(char* filename_bin, char* filename_image,
-                                       bin2gif_parameters *p_params);
+        int init_color_palette(char* name, color_palette *p_palette);
+        off_t estimate_memory_usage(char* filename_bin,
+                                    const bin2gif_parameters *p_params);
+        int find_file_range(char* filename_bin,
+                            const bin2gif_parameters *p_params,
+                            double *p_min, double *p_max);
+        int convert_binary_file_to_gifs(char* filename_bin,
+                                        const bin2gif_parameters *params_funcs, // NOLINT
+                                        int funcs_count,
+                                        const int *layers, int layers_count,
+                                        char** filenames_image, int *results);
+        int convert_binary_files_to_animated_gif(char** filenames_bin,
+                                                 int count,
+                                                 char* filename_image,
+                                                 const bin2gif_parameters *p_params); // NOLINT
     }
 }
 //---------------------------------------------------------------------------
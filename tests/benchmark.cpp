@@ -0,0 +1,241 @@
+#include <sys/time.h>
+#include <complex>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "../src/util_reduce.h"
+#include "../src/util_simd.h"
+using namespace std;
+//---------------------------------------------------------------------------
+double get_time() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec*1e-6;
+}
+//---------------------------------------------------------------------------
+double real_part(const complex<double> &c) {
+    return c.real();
+}
+//---------------------------------------------------------------------------
+double imag_part(const complex<double> &c) {
+    return c.imag();
+}
+//---------------------------------------------------------------------------
+// Reduction as done before kernels: pointer call and type test per element
+void reduce_legacy(void *data, sns::binary_file_type file_type,
+                   double (*func)(const complex<double>&),
+                   int bin_width, int to_width, int to_height,
+                   int factor_x, int factor_y, double *ddata) {
+    complex<double> *data_cd = static_cast<complex<double>*>(data);
+    double *data_d = static_cast<double*>(data);
+    int i = 0, j = 0, ii = 0, jj = 0;
+    off_t kk = 0;
+    double d_value = 0;
+
+    for (j = 0; j < to_height; j++) {
+        for (i = 0; i < to_width; i++) {
+            d_value = 0;
+            for (jj = 0; jj < factor_y; jj++) {
+                for (ii = 0; ii < factor_x; ii++) {
+                    kk = static_cast<off_t>(bin_width)*(factor_y*j + jj) +
+                         (factor_x*i + ii);
+                    if (file_type == sns::t_complex_double) {
+                        d_value += func(data_cd[kk]);
+                    } else {
+                        d_value += data_d[kk];
+                    }
+                }
+            }
+            ddata[to_width*j+i] = d_value/factor_x/factor_y;
+        }
+    }
+}
+//---------------------------------------------------------------------------
+sns::reduce::stripe_reducer get_template_reducer(
+        sns::binary_file_type file_type, sns::reduce::reduce_func func) {
+    if (file_type == sns::t_double) {
+        return sns::reduce::reduce_stripe<double, sns::reduce::func_real>;
+    }
+
+    switch (func) {
+        case sns::reduce::f_real:
+            return sns::reduce::reduce_stripe<complex<double>,
+                                              sns::reduce::func_real>;
+        case sns::reduce::f_imag:
+            return sns::reduce::reduce_stripe<complex<double>,
+                                              sns::reduce::func_imag>;
+        case sns::reduce::f_norm:
+            return sns::reduce::reduce_stripe<complex<double>,
+                                              sns::reduce::func_norm>;
+        case sns::reduce::f_arg:
+            return sns::reduce::reduce_stripe<complex<double>,
+                                              sns::reduce::func_arg>;
+        default:
+            return sns::reduce::reduce_stripe<complex<double>,
+                                              sns::reduce::func_abs>;
+    }
+}
+//---------------------------------------------------------------------------
+void reduce_kernel(void *data, sns::binary_file_type file_type,
+                   sns::reduce::stripe_reducer reducer,
+                   int bin_width, int to_width, int to_height,
+                   int factor_x, int factor_y, double *ddata) {
+    size_t element_size = (file_type == sns::t_complex_double)
+                          ? sizeof(complex<double>) : sizeof(double);
+    int j = 0;
+
+    for (j = 0; j < to_height; j++) {
+        reducer(static_cast<char*>(data) +
+                    element_size*bin_width*factor_y*j,
+                bin_width, to_width, factor_x, factor_y,
+                ddata + to_width*j);
+    }
+}
+//---------------------------------------------------------------------------
+double max_difference(const double *a, const double *b, int n) {
+    double d = 0;
+    int i = 0;
+
+    for (i = 0; i < n; i++) {
+        if (fabs(a[i] - b[i]) > d) {
+            d = fabs(a[i] - b[i]);
+        }
+    }
+
+    return d;
+}
+//---------------------------------------------------------------------------
+void bench(const char* name, sns::binary_file_type file_type,
+           double (*func)(const complex<double>&),
+           sns::reduce::reduce_func kernel_func, bool fast_math,
+           void *data, int n, int factor) {
+    int to_n = n/factor;
+    double *d1 = new double[to_n*to_n];
+    double *d2 = new double[to_n*to_n];
+    double *d3 = new double[to_n*to_n];
+    int repeat = 5, r = 0;
+
+    double t0 = get_time();
+    for (r = 0; r < repeat; r++) {
+        reduce_legacy(data, file_type, func, n, to_n, to_n,
+                      factor, factor, d1);
+    }
+    double t_legacy = (get_time() - t0)/repeat;
+
+    sns::reduce::stripe_reducer reducer = get_template_reducer(file_type,
+                                                               kernel_func);
+    t0 = get_time();
+    for (r = 0; r < repeat; r++) {
+        reduce_kernel(data, file_type, reducer, n, to_n, to_n,
+                      factor, factor, d2);
+    }
+    double t_template = (get_time() - t0)/repeat;
+
+    reducer = sns::reduce::get_stripe_reducer(file_type, kernel_func,
+                                              fast_math);
+    t0 = get_time();
+    for (r = 0; r < repeat; r++) {
+        reduce_kernel(data, file_type, reducer, n, to_n, to_n,
+                      factor, factor, d3);
+    }
+    double t_simd = (get_time() - t0)/repeat;
+
+    printf("%-9s %4d  %9.2f ms  %9.2f ms %5.2fx  %9.2f ms %5.2fx  %s %.1e\n",
+           name, factor, t_legacy*1e3,
+           t_template*1e3, t_legacy/t_template,
+           t_simd*1e3, t_legacy/t_simd,
+           memcmp(d1, d2, sizeof(double)*to_n*to_n) == 0 ? "same"
+                                                        : "DIFFERENT",
+           max_difference(d1, d3, to_n*to_n));
+
+    delete[] d1;
+    delete[] d2;
+    delete[] d3;
+}
+//---------------------------------------------------------------------------
+void bench_kernels(complex<double> *data, int count) {
+    const char* names[] = {"real", "imag", "abs", "norm", "arg", "arg fast"};
+    sns::reduce::reduce_func funcs[] = {
+        sns::reduce::f_real, sns::reduce::f_imag, sns::reduce::f_abs,
+        sns::reduce::f_norm, sns::reduce::f_arg, sns::reduce::f_arg
+    };
+    double *reference = new double[count];
+    double *out = new double[count];
+    int f = 0, level = 0, repeat = 5, r = 0;
+
+    printf("\nArray kernels over %d complex values\n", count);
+    printf("%-9s", "func");
+    for (level = 0; level <= sns::simd::get_simd_level(); level++) {
+        printf(" %18s", sns::simd::get_simd_name(
+                            static_cast<sns::simd::simd_level>(level)));
+    }
+    printf("  max diff\n");
+
+    for (f = 0; f < 6; f++) {
+        bool fast_math = (f == 5);
+        double diff = 0;
+
+        printf("%-9s", names[f]);
+        for (level = 0; level <= sns::simd::get_simd_level(); level++) {
+            sns::simd::complex_kernel kernel =
+                sns::simd::get_complex_kernel(funcs[f], fast_math,
+                    static_cast<sns::simd::simd_level>(level));
+
+            double t0 = get_time();
+            for (r = 0; r < repeat; r++) {
+                kernel(data, level == 0 ? reference : out, count);
+            }
+            printf(" %15.2f ms", (get_time() - t0)/repeat*1e3);
+
+            if (level > 0 && max_difference(reference, out, count) > diff) {
+                diff = max_difference(reference, out, count);
+            }
+        }
+        printf("  %.1e\n", diff);
+    }
+
+    delete[] reference;
+    delete[] out;
+}
+//---------------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    int n = 2048, i = 0;
+
+    complex<double> *data_cd = new complex<double>[n*n];
+    double *data_d = new double[n*n];
+    for (i = 0; i < n*n; i++) {
+        data_cd[i] = complex<double>(sin(0.001*i), cos(0.0007*i));
+        data_d[i] = sin(0.001*i);
+    }
+
+    printf("Reduction of %dx%d matrix: legacy path, templated kernels (bit-identical check), SIMD kernels (max difference)\n", // NOLINT
+           n, n);
+    printf("func    factor     legacy       template            %-7s\n",
+           sns::simd::get_simd_name(sns::simd::get_simd_level()));
+
+    bench("double", sns::t_double, real_part, sns::reduce::f_real, false,
+          data_d, n, 1);
+    bench("double", sns::t_double, real_part, sns::reduce::f_real, false,
+          data_d, n, 4);
+    bench("real", sns::t_complex_double, real_part, sns::reduce::f_real,
+          false, data_cd, n, 1);
+    bench("real", sns::t_complex_double, real_part, sns::reduce::f_real,
+          false, data_cd, n, 4);
+    bench("imag", sns::t_complex_double, imag_part, sns::reduce::f_imag,
+          false, data_cd, n, 4);
+    bench("abs", sns::t_complex_double, std::abs, sns::reduce::f_abs,
+          false, data_cd, n, 4);
+    bench("norm", sns::t_complex_double, std::norm, sns::reduce::f_norm,
+          false, data_cd, n, 4);
+    bench("arg", sns::t_complex_double, std::arg, sns::reduce::f_arg,
+          false, data_cd, n, 4);
+    bench("arg fast", sns::t_complex_double, std::arg, sns::reduce::f_arg,
+          true, data_cd, n, 4);
+
+    bench_kernels(data_cd, n*n);
+
+    delete[] data_cd;
+    delete[] data_d;
+
+    return 0;
+}
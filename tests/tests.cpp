@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <complex>
 #include <cstdio>
 using namespace std;
@@ -57,7 +58,7 @@ void create_file_gradient(char* filename, int w, int h) {
 }
 //---------------------------------------------------------------------------
 template<typename T>
-void create_file_gauss(char* filename, int w, int h) {
+void create_file_gauss(char* filename, int w, int h, double amp = 1) {
     int i = 0, j = 0;
 
     double w2 = static_cast<double>(w)/2;
@@ -67,9 +68,49 @@ void create_file_gauss(char* filename, int w, int h) {
 
     T *data = new T[w*h];
 
+    for (j = 0; j < h; j++) {
+        for (i = 0; i < w; i++) {
+            data[j*w+i] = amp*exp(-((i-w2)*(i-w2) + (j-h2)*(j-h2))/r/r);
+        }
+    }
+
+    FILE *fp = fopen(filename, "wb");
+
+    if (!fp) {
+        printf("Test file %s doesn't created.\n", filename);
+        return;
+    }
+
+    fwrite(data, sizeof(T), w*h, fp);
+
+    fclose(fp);
+
+    delete[] data;
+
+    printf("Test file %s created.\n", filename);
+}
+//---------------------------------------------------------------------------
+// Big-endian file of real type, as written on other hosts
+template<typename T>
+void create_file_gauss_swapped(char* filename, int w, int h) {
+    int i = 0, j = 0;
+    unsigned int k = 0;
+
+    double w2 = static_cast<double>(w)/2;
+    double h2 = static_cast<double>(h)/2;
+
+    double r = static_cast<double>(w+h)/13;
+
+    T *data = new T[w*h];
+
     for (j = 0; j < h; j++) {
         for (i = 0; i < w; i++) {
             data[j*w+i] = exp(-((i-w2)*(i-w2) + (j-h2)*(j-h2))/r/r);
+
+            unsigned char *bytes = reinterpret_cast<unsigned char*>(&data[j*w+i]);
+            for (k = 0; k < sizeof(T)/2; k++) {
+                swap(bytes[k], bytes[sizeof(T) - 1 - k]);
+            }
         }
     }
 
@@ -175,6 +216,56 @@ void create_file_gauss_axial(char* filename, int nr) {
     printf("Test file %s created.\n", filename);
 }
 //---------------------------------------------------------------------------
+// Gauss spreading in time, one layer per time step
+template<typename T>
+void create_file_gauss_axial_layers(char* filename, int nr, int nt) {
+    int i = 0, t = 0;
+
+    T *data = new T[nr*nt];
+    double grid_t[nt];
+    double grid_r[nr];
+
+    for (i = 0; i < nr; i++) {
+        grid_r[i] = i;
+    }
+
+    for (t = 0; t < nt; t++) {
+        double r = static_cast<double>(nr)/5*(1 + static_cast<double>(t)/nt);
+
+        grid_t[t] = t;
+        for (i = 0; i < nr; i++) {
+            data[t*nr+i] = exp(-(grid_r[i]*grid_r[i])/r/r);
+        }
+    }
+
+    FILE *fp = fopen(filename, "wb");
+
+    if (!fp) {
+        printf("Test file %s doesn't created.\n", filename);
+        return;
+    }
+
+    // Write Nr
+    fwrite(&nr, sizeof(int), 1, fp);
+
+    // Write grid_r
+    fwrite(grid_r, sizeof(double), nr, fp);
+
+    // Write Nt
+    fwrite(&nt, sizeof(int), 1, fp);
+
+    // Write grid_t
+    fwrite(grid_t, sizeof(double), nt, fp);
+
+    fwrite(data, sizeof(T), nr*nt, fp);
+
+    fclose(fp);
+
+    delete[] data;
+
+    printf("Test file %s created.\n", filename);
+}
+//---------------------------------------------------------------------------
 int main(int argc, char *argv[]) {
     create_file_const<double>("./tests/one512x512.dbl", 512, 512, 1.);
     create_file_const<double>("./tests/zero512x512.dbl", 512, 512, 0.);
@@ -191,6 +282,13 @@ int main(int argc, char *argv[]) {
     create_file_gauss<double>("./tests/gauss1024x1024.dbl", 1024, 1024);
     create_file_gauss< complex<double> >("./tests/gauss1024x1024.cpl", 1024, 1024);
 
+    // Other --type inputs, integers are scaled to their range
+    create_file_gauss<float>("./tests/gauss1024x1024_float.flt", 1024, 1024);
+    create_file_gauss< complex<float> >("./tests/gauss1024x1024_cfloat.cflt", 1024, 1024);
+    create_file_gauss<short>("./tests/gauss1024x1024_int16.i16", 1024, 1024, 30000.);
+    create_file_gauss<int>("./tests/gauss1024x1024_int32.i32", 1024, 1024, 1e9);
+    create_file_gauss_swapped<double>("./tests/gauss1024x1024_be.dbl", 1024, 1024);
+
     create_file_const_axial<double>("./tests/one512_axial.adbl", 512, 1.);
     create_file_const_axial<double>("./tests/zero512_axial.adbl", 512, 0.);
     create_file_const_axial< complex<double> >("./tests/one512_axial.acpl", 512, 1.);
@@ -199,6 +297,10 @@ int main(int argc, char *argv[]) {
     create_file_gauss_axial<double>("./tests/gauss512_axial.adbl", 512);
     create_file_gauss_axial< complex<double> >("./tests/gauss512_axial.acpl", 512);
 
+    // Several time layers for --layer, --layers and --axial-all
+    create_file_gauss_axial_layers<double>("./tests/gauss512x16_axial.adbl", 512, 16);
+    create_file_gauss_axial_layers< complex<double> >("./tests/gauss512x16_axial.acpl", 512, 16);
+
     create_file_const_axial<double>("./tests/one5_axial.adbl", 5, 1.);
     create_file_const_axial<double>("./tests/one50_axial.adbl", 50, 1.);
     create_file_const_axial<double>("./tests/one777_axial.adbl", 777, 1.);